@@ -4,6 +4,7 @@
 #include <stdio.h>
 #include <stdbool.h>
 #include <string.h>
+#include "ufpairs.h"
 #define N 10000
 
 /*
@@ -19,6 +20,9 @@ int main(int argc, char *argv[]) {
     int i, j, p, q, t, id[N], sz[N], largest_seen = -1;
     bool dumpstate = false;
     bool dumppaths = false;
+    int relabel = UFP_RELABEL_NONE;
+    struct ufpairs pairs = { 0 };
+    size_t k;
 
     // Check args
     for (int ai = 1; ai < argc; ai++) {
@@ -28,7 +32,14 @@ int main(int argc, char *argv[]) {
         else if (!strcmp(argv[ai], "-dp") ||
             !strcmp(argv[ai], "--dumppaths"))
             dumppaths = true;
-        else {
+        else if (!strncmp(argv[ai], "-rl=", 4) ||
+            !strncmp(argv[ai], "--relabel=", 10)) {
+            relabel = ufp_parse_relabel(strchr(argv[ai], '=') + 1);
+            if (relabel < 0) {
+                fprintf(stderr, "Unknown relabel strategy: %s (expected firsttouch, bfs or degree). Exiting.\n", argv[ai]);
+                return 3;
+            }
+        } else {
             fprintf(stderr, "Unexpected argument: %s. Exiting.\n", argv[ai]);
             return 3;
         }
@@ -39,10 +50,32 @@ int main(int argc, char *argv[]) {
         sz[i] = 1;
     } // for (i...)
 
-    while (scanf("%d %d\n", &p, &q) == 2) {
-        // Record largest seen
-        if (largest_seen < p) largest_seen = p;
-        if (largest_seen < q) largest_seen = q;
+    // Relabelling needs to see the whole input before union-find starts,
+    // so load all pairs up front and renumber the sites for locality
+    if (relabel != UFP_RELABEL_NONE) {
+        ufp_load(&pairs, stdin);
+
+        if (pairs.largest_seen >= N) {
+            fprintf(stderr, "Site id %d out of range (max %d). Exiting.\n", pairs.largest_seen, N - 1);
+            return 4;
+        }
+
+        ufp_relabel(&pairs, relabel);
+        largest_seen = pairs.largest_seen;
+    }
+
+    for (k = 0; ; k++) {
+        if (relabel != UFP_RELABEL_NONE) {
+            if (k >= pairs.ct) break;
+            p = pairs.pair[k].p;
+            q = pairs.pair[k].q;
+        } else {
+            if (scanf("%d %d\n", &p, &q) != 2) break;
+
+            // Record largest seen
+            if (largest_seen < p) largest_seen = p;
+            if (largest_seen < q) largest_seen = q;
+        }
 
         // Follow links until we find the set representative, i for p, and j for q
         for (i = p; i != id[i]; i = id[i]) ;
@@ -70,13 +103,22 @@ int main(int argc, char *argv[]) {
         }
 
         // Emit this connection, it is part of the spanning tree
-        printf(" %d %d\n", p, q);
+        // (always reported using the site ids from the input)
+        printf(" %d %d\n", ufp_orig(&pairs, p), ufp_orig(&pairs, q));
 
-    } // while (scanf(...))
+    } // for (k...)
 
+    // The dumps below are indexed by original site id; t is the relabelled
+    // site for original id i, or -1 for a site that never appeared
     if (dumpstate) {
-        for (i = 0; i < largest_seen; i++)
-            fprintf(stderr, " %d -> (id %d, sz %d)%s\n", i, id[i], sz[i], ((id[i] == i) ? " **" : ""));
+        for (i = 0; i < largest_seen; i++) {
+            t = (relabel != UFP_RELABEL_NONE) ? pairs.to_new[i] : i;
+
+            if (t < 0)
+                fprintf(stderr, " %d -> (id %d, sz %d) **\n", i, i, 1);
+            else
+                fprintf(stderr, " %d -> (id %d, sz %d)%s\n", i, ufp_orig(&pairs, id[t]), sz[t], ((id[t] == t) ? " **" : ""));
+        }
     } // if dumpstate
 
     if (dumppaths) {
@@ -85,13 +127,18 @@ int main(int argc, char *argv[]) {
         for (i = 0; i < largest_seen; i++) {
             fprintf(stderr, "%d", i);
 
-            for (j = i; id[j] != j; ) {
+            t = (relabel != UFP_RELABEL_NONE) ? pairs.to_new[i] : i;
+
+            for (j = t; j >= 0 && id[j] != j; ) {
                 j = id[j];
-                fprintf(stderr, " -> %d", j);
+                fprintf(stderr, " -> %d", ufp_orig(&pairs, j));
             }
 
             fprintf(stderr, "\n");
         }
     } // if dumppaths
 
+    if (relabel != UFP_RELABEL_NONE)
+        ufp_dispose(&pairs);
+
 } // main()
@@ -0,0 +1,704 @@
+
+/* vim: set ts=8 sts=4 sw=4 et filetype=c: */
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "ufpairs.h"
+
+/*
+ ***************************************************************
+ * uf.c         Run connectivity algorithms side by side on    *
+ *              one loaded input                               *
+ *                                                             *
+ * Source(s):   Algorithms in C, 3rd Ed., Robert Sedgewick     *
+ *              Chapter 1, Section 1.3, Programs 1.1 - 1.4     *
+ ***************************************************************
+ */
+
+// Usage: $0 [--algo=<name>[,<name>...]] [--relabel=<strategy>] [--threads=<n>] [--emit] < pairs
+//        $0 --verify=<forest file> [--threads=<n>] < pairs
+
+#define UF_MAX_THREADS 256
+#define UF_VERIFY_MAX_REPORTS 10
+
+
+struct uf_run {
+    /* input, shared by every algorithm */
+    const struct ufpairs   *up;
+    int                     thread_ct;
+
+    /* per-algorithm state, reset before each run */
+    int                    *id;
+    int                    *sz;
+    bool                   *used;           // used[k] set if pair k joined two sets
+};
+
+struct uf_algo {
+    const char     *name;
+    size_t        (*run)(struct uf_run *ur);
+};
+
+size_t uf_quickfind(struct uf_run *ur) {
+    /*
+     * Program 1.1 Quick-find
+     */
+    const struct ufpairs   *up = ur->up;
+    int                    *id = ur->id;
+    int                     p, q, t;
+    size_t                  unions = 0;
+
+    for (size_t k = 0; k < up->ct; k++) {
+        p = up->pair[k].p;
+        q = up->pair[k].q;
+
+        if (id[p] == id[q]) continue;
+
+        for (t = id[p], p = 0; p < up->site_ct; p++)
+            if (id[p] == t)
+                id[p] = id[q];
+
+        ur->used[k] = true;
+        unions++;
+    }
+
+    return unions;
+}
+
+size_t uf_quickunion(struct uf_run *ur) {
+    /*
+     * Program 1.2 Quick-union
+     */
+    const struct ufpairs   *up = ur->up;
+    int                    *id = ur->id;
+    int                     i, j;
+    size_t                  unions = 0;
+
+    for (size_t k = 0; k < up->ct; k++) {
+        for (i = up->pair[k].p; i != id[i]; i = id[i]) ;
+        for (j = up->pair[k].q; j != id[j]; j = id[j]) ;
+        if (i == j) continue;
+        id[i] = j;
+
+        ur->used[k] = true;
+        unions++;
+    }
+
+    return unions;
+}
+
+size_t uf_weighted(struct uf_run *ur) {
+    /*
+     * Program 1.3 Weighted quick-union
+     */
+    const struct ufpairs   *up = ur->up;
+    int                    *id = ur->id;
+    int                    *sz = ur->sz;
+    int                     i, j;
+    size_t                  unions = 0;
+
+    for (size_t k = 0; k < up->ct; k++) {
+        for (i = up->pair[k].p; i != id[i]; i = id[i]) ;
+        for (j = up->pair[k].q; j != id[j]; j = id[j]) ;
+        if (i == j) continue;
+
+        if (sz[i] < sz[j]) {
+            id[i] = j; sz[j] += sz[i];
+        } else {
+            id[j] = i; sz[i] += sz[j];
+        }
+
+        ur->used[k] = true;
+        unions++;
+    }
+
+    return unions;
+}
+
+size_t uf_weighted_compress(struct uf_run *ur) {
+    /*
+     * Program 1.4 Path compression by halving
+     */
+    const struct ufpairs   *up = ur->up;
+    int                    *id = ur->id;
+    int                    *sz = ur->sz;
+    int                     i, j;
+    size_t                  unions = 0;
+
+    for (size_t k = 0; k < up->ct; k++) {
+        for (i = up->pair[k].p; i != id[i]; i = id[i])
+            id[i] = id[id[i]];
+        for (j = up->pair[k].q; j != id[j]; j = id[j])
+            id[j] = id[id[j]];
+        if (i == j) continue;
+
+        if (sz[i] < sz[j]) {
+            id[i] = j; sz[j] += sz[i];
+        } else {
+            id[j] = i; sz[i] += sz[j];
+        }
+
+        ur->used[k] = true;
+        unions++;
+    }
+
+    return unions;
+}
+
+struct uf_concurrent_worker {
+    pthread_t       thread;
+    struct uf_run  *ur;
+    size_t          first;
+    size_t          last;
+    size_t          unions;
+};
+
+static int uf_concurrent_find_(int *id, int i) {
+    /*
+     * Find the root of site i, halving the path as we go. The halving
+     * step is a CAS so that it can never undo a link made concurrently
+     * by another thread.
+     */
+    int         parent, grandparent;
+
+    for ( ; ; ) {
+        parent = __atomic_load_n(&id[i], __ATOMIC_ACQUIRE);
+        if (parent == i) return i;
+
+        grandparent = __atomic_load_n(&id[parent], __ATOMIC_ACQUIRE);
+        if (grandparent != parent)
+            __atomic_compare_exchange_n(&id[i], &parent, grandparent, true, __ATOMIC_RELEASE, __ATOMIC_RELAXED);
+
+        i = grandparent;
+    }
+}
+
+static void *uf_concurrent_worker_(void *arg) {
+    struct uf_concurrent_worker    *w = arg;
+    int                            *id = w->ur->id;
+    int                             i, j, expected;
+
+    for (size_t k = w->first; k < w->last; k++) {
+        i = w->ur->up->pair[k].p;
+        j = w->ur->up->pair[k].q;
+
+        for ( ; ; ) {
+            i = uf_concurrent_find_(id, i);
+            j = uf_concurrent_find_(id, j);
+            if (i == j) break;
+
+            // Always hang the lower-numbered root under the higher-numbered
+            // one, which keeps concurrent links from ever forming a cycle
+            if (i > j) { int t = i; i = j; j = t; }
+
+            expected = i;
+            if (__atomic_compare_exchange_n(&id[i], &expected, j, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+                w->ur->used[k] = true;
+                w->unions++;
+                break;
+            }
+
+            // Lost a race, i is no longer a root - go round again
+        }
+    }
+
+    return NULL;
+}
+
+size_t uf_concurrent(struct uf_run *ur) {
+    /*
+     * Lock-free quick-union with path halving, with the pair array split
+     * into one contiguous slice per thread
+     */
+    struct uf_concurrent_worker     w[UF_MAX_THREADS];
+    size_t                          slice, unions = 0;
+    int                             t;
+
+    slice = (ur->up->ct + ur->thread_ct - 1) / ur->thread_ct;
+
+    for (t = 0; t < ur->thread_ct; t++) {
+        w[t].ur = ur;
+        w[t].first = (size_t)t * slice;
+        w[t].last = w[t].first + slice;
+        w[t].unions = 0;
+
+        if (w[t].first > ur->up->ct) w[t].first = ur->up->ct;
+        if (w[t].last > ur->up->ct) w[t].last = ur->up->ct;
+
+        if (pthread_create(&w[t].thread, NULL, uf_concurrent_worker_, &w[t]) != 0) {
+            fprintf(stderr, "[uf_concurrent] pthread_create failed.\n");
+            exit(4);
+        }
+    }
+
+    for (t = 0; t < ur->thread_ct; t++) {
+        pthread_join(w[t].thread, NULL);
+        unions += w[t].unions;
+    }
+
+    return unions;
+}
+
+static const struct uf_algo uf_algos[] = {
+    { "quickfind",          uf_quickfind },
+    { "quickunion",         uf_quickunion },
+    { "weighted",           uf_weighted },
+    { "weighted-compress",  uf_weighted_compress },
+    { "concurrent",         uf_concurrent },
+};
+
+#define UF_ALGO_CT ((int)(sizeof(uf_algos) / sizeof(uf_algos[0])))
+
+static double uf_elapsed_ms_(const struct timespec *start, const struct timespec *end) {
+    return ((double)(end->tv_sec - start->tv_sec) * 1e3) +
+           ((double)(end->tv_nsec - start->tv_nsec) / 1e6);
+}
+
+static bool uf_select_algos_(const char *list, bool *selected) {
+    /*
+     * Parse a comma-separated list of algorithm names into selected[]
+     *
+     * Returns:
+     *      true on success
+     *      false if a name was not recognised
+     */
+    const char *name = list;
+    size_t      name_len;
+    int         a;
+
+    while (*name) {
+        name_len = strcspn(name, ",");
+
+        for (a = 0; a < UF_ALGO_CT; a++) {
+            if (strlen(uf_algos[a].name) == name_len &&
+                !strncmp(uf_algos[a].name, name, name_len))
+                break;
+        }
+
+        if (a == UF_ALGO_CT) {
+            fprintf(stderr, "Unknown algorithm: %.*s.\n", (int)name_len, name);
+            return false;
+        }
+
+        selected[a] = true;
+
+        name += name_len;
+        if (*name == ',') name++;
+    }
+
+    return true;
+}
+
+struct uf_verify_worker {
+    pthread_t       thread;
+    int             first;
+    int             last;
+
+    /* shared, read-only while workers run */
+    const int      *id_in;          // union-find over the input pairs
+    const int      *id_sf;          // union-find over the spanning forest
+    int            *label_in;
+    int            *label_sf;
+
+    /* results */
+    size_t          mismatch_ct;
+    int             first_mismatch;
+};
+
+static void *uf_verify_label_worker_(void *arg) {
+    /*
+     * Label each site in our slice with its root in both structures.
+     * Both have finished all their unions, so finds here are read-only
+     * and can safely run in parallel.
+     */
+    struct uf_verify_worker    *w = arg;
+    int                         i, r;
+
+    for (i = w->first; i < w->last; i++) {
+        for (r = i; r != w->id_in[r]; r = w->id_in[r]) ;
+        w->label_in[i] = r;
+        for (r = i; r != w->id_sf[r]; r = w->id_sf[r]) ;
+        w->label_sf[i] = r;
+    }
+
+    return NULL;
+}
+
+static void *uf_verify_compare_worker_(void *arg) {
+    /*
+     * Two partitions are the same iff every site is in the same component
+     * as its component's representative under the other partition, in
+     * both directions - which needs no sorting or hashing, just two
+     * lookups per site.
+     */
+    struct uf_verify_worker    *w = arg;
+    int                         i;
+
+    for (i = w->first; i < w->last; i++) {
+        if (w->label_sf[i] != w->label_sf[w->label_in[i]] ||
+            w->label_in[i] != w->label_in[w->label_sf[i]]) {
+            if (w->mismatch_ct == 0) w->first_mismatch = i;
+            w->mismatch_ct++;
+        }
+    }
+
+    return NULL;
+}
+
+static void uf_verify_run_workers_(struct uf_verify_worker *w, int thread_ct, void *(*fn)(void *)) {
+    for (int t = 0; t < thread_ct; t++) {
+        if (pthread_create(&w[t].thread, NULL, fn, &w[t]) != 0) {
+            fprintf(stderr, "[uf_verify] pthread_create failed.\n");
+            exit(4);
+        }
+    }
+
+    for (int t = 0; t < thread_ct; t++)
+        pthread_join(w[t].thread, NULL);
+}
+
+static void uf_radix_sort_(uint64_t *key, uint64_t *tmp, size_t n) {
+    /*
+     * LSD radix sort of n 64-bit keys, 16 bits per pass
+     */
+    size_t     *count;
+    uint64_t   *swap;
+
+    count = malloc(65536 * sizeof(size_t));
+
+    if (count == NULL) {
+        perror("[uf_radix_sort_] malloc");
+        exit(4);
+    }
+
+    for (int shift = 0; shift < 64; shift += 16) {
+        size_t  sum = 0, c;
+
+        memset(count, 0, 65536 * sizeof(size_t));
+
+        for (size_t k = 0; k < n; k++)
+            count[(key[k] >> shift) & 0xffff]++;
+
+        for (int d = 0; d < 65536; d++) {
+            c = count[d];
+            count[d] = sum;
+            sum += c;
+        }
+
+        for (size_t k = 0; k < n; k++)
+            tmp[count[(key[k] >> shift) & 0xffff]++] = key[k];
+
+        swap = key; key = tmp; tmp = swap;
+    }
+
+    // Four passes, so the sorted keys have ended up back in key[]
+    free(count);
+}
+
+static inline uint64_t uf_edge_key_(const struct ufpair *e) {
+    /* Order-independent key for an edge */
+    return (e->p < e->q) ? (((uint64_t)e->p << 32) | (uint32_t)e->q)
+                         : (((uint64_t)e->q << 32) | (uint32_t)e->p);
+}
+
+int uf_verify(struct ufpairs *input, const char *forest_path, int thread_ct) {
+    /*
+     * Check that the edges in file forest_path (e.g. the output of
+     * prog-1.3, or of uf --emit with a single algorithm) form a spanning
+     * forest of the input pairs:
+     *
+     *      1. every edge is one of the input pairs
+     *      2. the edges are acyclic
+     *      3. the edges connect exactly the same sets of sites as the input
+     *
+     * Returns:
+     *      number of problems found (0 if the forest is valid)
+     */
+    struct ufpairs              forest;
+    struct uf_run               ur_in, ur_sf;
+    struct uf_verify_worker     w[UF_MAX_THREADS];
+    struct timespec             start, end;
+    FILE                       *fp;
+    uint64_t                   *key, *tmp, k_sf;
+    int                        *label_in, *label_sf;
+    int                         site_ct, slice;
+    size_t                      lo, hi, mid;
+    size_t                      problems = 0, missing = 0, cycles = 0, mismatches = 0;
+
+    fp = fopen(forest_path, "r");
+
+    if (fp == NULL) {
+        perror("[uf_verify] fopen");
+        exit(4);
+    }
+
+    ufp_load(&forest, fp);
+    fclose(fp);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    site_ct = (input->site_ct > forest.site_ct) ? input->site_ct : forest.site_ct;
+    input->site_ct = forest.site_ct = site_ct;
+
+    // 1. Every edge must be an input pair - sort the input's edge keys once,
+    //    then binary search for each forest edge
+    key = malloc((input->ct + 1) * sizeof(uint64_t));
+    tmp = malloc((input->ct + 1) * sizeof(uint64_t));
+
+    if (key == NULL || tmp == NULL) {
+        perror("[uf_verify] malloc");
+        exit(4);
+    }
+
+    for (size_t k = 0; k < input->ct; k++)
+        key[k] = uf_edge_key_(&(input->pair[k]));
+
+    uf_radix_sort_(key, tmp, input->ct);
+    free(tmp);
+
+    for (size_t k = 0; k < forest.ct; k++) {
+        k_sf = uf_edge_key_(&(forest.pair[k]));
+
+        for (lo = 0, hi = input->ct; lo < hi; ) {
+            mid = lo + ((hi - lo) / 2);
+            if (key[mid] < k_sf) lo = mid + 1; else hi = mid;
+        }
+
+        if (lo == input->ct || key[lo] != k_sf) {
+            if (missing++ < UF_VERIFY_MAX_REPORTS)
+                fprintf(stderr, "  edge %zu (%d %d) is not an input pair\n", k, forest.pair[k].p, forest.pair[k].q);
+        }
+    }
+
+    free(key);
+
+    // 2./3. Run our own union-find pass over both the input and the forest.
+    //    Any forest edge which doesn't join two sets closes a cycle.
+    ur_in.up = input;
+    ur_sf.up = &forest;
+    ur_in.thread_ct = ur_sf.thread_ct = 1;
+
+    ur_in.id = malloc((size_t)site_ct * sizeof(int) + 1);
+    ur_in.sz = malloc((size_t)site_ct * sizeof(int) + 1);
+    ur_in.used = malloc(input->ct + 1);
+    ur_sf.id = malloc((size_t)site_ct * sizeof(int) + 1);
+    ur_sf.sz = malloc((size_t)site_ct * sizeof(int) + 1);
+    ur_sf.used = malloc(forest.ct + 1);
+    label_in = malloc((size_t)site_ct * sizeof(int) + 1);
+    label_sf = malloc((size_t)site_ct * sizeof(int) + 1);
+
+    if (ur_in.id == NULL || ur_in.sz == NULL || ur_in.used == NULL ||
+        ur_sf.id == NULL || ur_sf.sz == NULL || ur_sf.used == NULL ||
+        label_in == NULL || label_sf == NULL) {
+        perror("[uf_verify] malloc");
+        exit(4);
+    }
+
+    for (int i = 0; i < site_ct; i++) {
+        ur_in.id[i] = ur_sf.id[i] = i;
+        ur_in.sz[i] = ur_sf.sz[i] = 1;
+    }
+    memset(ur_in.used, 0, input->ct);
+    memset(ur_sf.used, 0, forest.ct);
+
+    uf_weighted_compress(&ur_in);
+    uf_weighted_compress(&ur_sf);
+
+    for (size_t k = 0; k < forest.ct; k++) {
+        if (!ur_sf.used[k]) {
+            if (cycles++ < UF_VERIFY_MAX_REPORTS)
+                fprintf(stderr, "  edge %zu (%d %d) closes a cycle\n", k, forest.pair[k].p, forest.pair[k].q);
+        }
+    }
+
+    // Label every site with its component in both, then compare labels,
+    // each in parallel over slices of the site range
+    slice = (site_ct + thread_ct - 1) / thread_ct;
+
+    for (int t = 0; t < thread_ct; t++) {
+        w[t].first = (t * slice < site_ct) ? t * slice : site_ct;
+        w[t].last = (w[t].first + slice < site_ct) ? w[t].first + slice : site_ct;
+        w[t].id_in = ur_in.id;
+        w[t].id_sf = ur_sf.id;
+        w[t].label_in = label_in;
+        w[t].label_sf = label_sf;
+        w[t].mismatch_ct = 0;
+        w[t].first_mismatch = -1;
+    }
+
+    uf_verify_run_workers_(w, thread_ct, uf_verify_label_worker_);
+    uf_verify_run_workers_(w, thread_ct, uf_verify_compare_worker_);
+
+    for (int t = 0; t < thread_ct; t++) {
+        if (w[t].mismatch_ct == 0) continue;
+
+        if (mismatches < UF_VERIFY_MAX_REPORTS) {
+            int i = w[t].first_mismatch;
+            fprintf(stderr, "  site %d: input component %d, forest component %d (+%zu more in sites %d..%d)\n",
+                    i, label_in[i], label_sf[i], w[t].mismatch_ct - 1, w[t].first, w[t].last - 1);
+        }
+        mismatches += w[t].mismatch_ct;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    problems = missing + cycles + mismatches;
+
+    fprintf(stderr, "Verified %zu edges against %zu pairs, %d sites in %.3f ms: "
+            "%zu not in input, %zu closing cycles, %zu sites in wrong component.\n",
+            forest.ct, input->ct, site_ct, uf_elapsed_ms_(&start, &end),
+            missing, cycles, mismatches);
+
+    // Clean up
+    free(label_sf);
+    free(label_in);
+    free(ur_sf.used);
+    free(ur_sf.sz);
+    free(ur_sf.id);
+    free(ur_in.used);
+    free(ur_in.sz);
+    free(ur_in.id);
+    ufp_dispose(&forest);
+
+    return (problems > 0) ? 1 : 0;
+}
+
+void usage(char *progname) {
+    fprintf(stderr, "Usage: %s [--algo=<name>[,<name>...]] [--relabel=<strategy>] [--threads=<n>] [--emit] < pairs\n", progname);
+    fprintf(stderr, "       %s --verify=<forest file> [--threads=<n>] < pairs\n", progname);
+    fprintf(stderr, "  algorithms: quickfind, quickunion, weighted, weighted-compress, concurrent (default: all)\n");
+    fprintf(stderr, "  relabel strategies: none, firsttouch, bfs, degree\n");
+}
+
+int main(int argc, char *argv[]) {
+    struct ufpairs      pairs;
+    struct uf_run       ur;
+    struct timespec     start, end;
+    bool                selected[UF_ALGO_CT] = { false };
+    bool                any_selected = false;
+    bool                emit = false;
+    char               *verify_path = NULL;
+    int                 relabel = UFP_RELABEL_NONE;
+    int                 thread_ct;
+    size_t              unions;
+
+    thread_ct = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (thread_ct < 1) thread_ct = 1;
+
+    // Check args
+    for (int ai = 1; ai < argc; ai++) {
+        if (!strncmp(argv[ai], "--algo=", 7)) {
+            if (!uf_select_algos_(argv[ai] + 7, selected)) {
+                usage(argv[0]);
+                return 3;
+            }
+        } else if (!strncmp(argv[ai], "--relabel=", 10)) {
+            relabel = ufp_parse_relabel(argv[ai] + 10);
+            if (relabel < 0) {
+                fprintf(stderr, "Unknown relabel strategy: %s. Exiting.\n", argv[ai] + 10);
+                return 3;
+            }
+        } else if (!strncmp(argv[ai], "--threads=", 10)) {
+            thread_ct = atoi(argv[ai] + 10);
+            if (thread_ct < 1 || thread_ct > UF_MAX_THREADS) {
+                fprintf(stderr, "Thread count must be between 1 and %d. Exiting.\n", UF_MAX_THREADS);
+                return 3;
+            }
+        } else if (!strncmp(argv[ai], "--verify=", 9)) {
+            verify_path = argv[ai] + 9;
+        } else if (!strcmp(argv[ai], "--emit")) {
+            emit = true;
+        } else {
+            fprintf(stderr, "Unexpected argument: %s. Exiting.\n", argv[ai]);
+            usage(argv[0]);
+            return 3;
+        }
+    }
+
+    for (int a = 0; a < UF_ALGO_CT; a++)
+        any_selected |= selected[a];
+
+    if (verify_path != NULL && (any_selected || emit || relabel != UFP_RELABEL_NONE)) {
+        fprintf(stderr, "--verify can only be combined with --threads. Exiting.\n");
+        return 3;
+    }
+
+    // Verifier mode: check a spanning forest against the input and exit
+    if (verify_path != NULL) {
+        int verify_rv;
+
+        ufp_load(&pairs, stdin);
+        verify_rv = uf_verify(&pairs, verify_path, thread_ct);
+        ufp_dispose(&pairs);
+
+        return (verify_rv != 0) ? 5 : 0;
+    }
+
+    if (!any_selected) {
+        for (int a = 0; a < UF_ALGO_CT; a++)
+            selected[a] = true;
+    }
+
+    // Load the pair stream once - none of the timings below include I/O
+    ufp_load(&pairs, stdin);
+    ufp_relabel(&pairs, relabel);
+
+    fprintf(stderr, "Loaded %zu pairs, %d sites (%d ids).\n", pairs.ct, pairs.distinct_ct, pairs.site_ct);
+
+    ur.up = &pairs;
+    ur.thread_ct = thread_ct;
+    ur.id = malloc(((size_t)pairs.site_ct + 1) * sizeof(int));
+    ur.sz = malloc(((size_t)pairs.site_ct + 1) * sizeof(int));
+    ur.used = malloc((pairs.ct + 1) * sizeof(bool));
+
+    if (ur.id == NULL || ur.sz == NULL || ur.used == NULL) {
+        perror("malloc");
+        exit(4);
+    }
+
+    for (int a = 0; a < UF_ALGO_CT; a++) {
+        if (!selected[a]) continue;
+
+        // Reset state
+        for (int i = 0; i < pairs.site_ct; i++) {
+            ur.id[i] = i;
+            ur.sz[i] = 1;
+        }
+        memset(ur.used, 0, pairs.ct * sizeof(bool));
+
+        // Run and time
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        unions = uf_algos[a].run(&ur);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+
+        fprintf(stderr, "%-18s %12.3f ms %10zu unions %10zu components\n",
+                uf_algos[a].name, uf_elapsed_ms_(&start, &end), unions,
+                (size_t)pairs.distinct_ct - unions);
+
+        // Emit spanning forest, in input order
+        if (emit) {
+            printf("# %s\n", uf_algos[a].name);
+
+            for (size_t k = 0; k < pairs.ct; k++)
+                if (ur.used[k])
+                    printf(" %d %d\n", ufp_orig(&pairs, pairs.pair[k].p), ufp_orig(&pairs, pairs.pair[k].q));
+        }
+    }
+
+    // Clean up
+    free(ur.used);
+    free(ur.sz);
+    free(ur.id);
+    ufp_dispose(&pairs);
+
+    return 0;
+
+} // main()
@@ -0,0 +1,245 @@
+
+/* vim: set ts=8 sts=4 sw=4 et filetype=c: */
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ufpairs.h"
+
+/*
+ ***************************************************************
+ * ufagg.c      Weighted quick-union with per-component        *
+ *              aggregates, maintained during union            *
+ *                                                             *
+ * Source(s):   Algorithms in C, 3rd Ed., Robert Sedgewick     *
+ *              Chapter 1, Section 1.3, Program 1.3. (Page 17) *
+ *              Chapter 1, Section 1.3, Program 1.4. (Page 18) *
+ ***************************************************************
+ */
+
+// Usage: $0 [--attrs=<file>] < commands
+//
+// Attribute file lines:    <site> <weight> <attribute> <flag 0|1>
+// Command lines:           <p> <q>     union p and q, emitting the pair if it is new
+//                          ? <p>       report aggregates of p's component, with
+//                                      min and max over sites in the attribute
+//                                      file only ("-" if there are none)
+
+#define UFAGG_MAX_LINE 128
+
+
+struct ufagg_val {
+    /* per-component aggregates, only meaningful at a root */
+    int         sz;             // number of sites
+    long long   sum;            // total weight
+    int         attr_ct;        // number of sites given an attribute
+    int         min;            // smallest attribute, if attr_ct > 0
+    int         max;            // largest attribute, if attr_ct > 0
+    int         flagged;        // number of flagged sites
+};
+
+struct ufagg {
+    int                *id;
+    struct ufagg_val   *agg;
+    int                 site_cap;
+};
+
+void ufagg_grow(struct ufagg *ua, int site) {
+    /*
+     * Make sure the arrays can hold site, initializing any new sites
+     * as singleton sets with zero weight and no attribute
+     */
+    int         new_cap;
+
+    new_cap = ufp_grow_cap(ua->site_cap, site, "[ufagg_grow]");
+
+    ua->id = realloc(ua->id, (size_t)new_cap * sizeof(int));
+    ua->agg = realloc(ua->agg, (size_t)new_cap * sizeof(struct ufagg_val));
+
+    if (ua->id == NULL || ua->agg == NULL) {
+        perror("[ufagg_grow] realloc");
+        exit(4);
+    }
+
+    for (int i = ua->site_cap; i < new_cap; i++) {
+        ua->id[i] = i;
+        ua->agg[i].sz = 1;
+        ua->agg[i].sum = 0;
+        ua->agg[i].attr_ct = 0;
+        ua->agg[i].min = 0;
+        ua->agg[i].max = 0;
+        ua->agg[i].flagged = 0;
+    }
+
+    ua->site_cap = new_cap;
+}
+
+void ufagg_set(struct ufagg *ua, int site, long long weight, int attr, bool flagged) {
+    /*
+     * Set the weight, attribute and flag of a site which is still in a
+     * set of its own
+     *
+     * Asserts:
+     *      site is a singleton set
+     */
+    if (site >= ua->site_cap) ufagg_grow(ua, site);
+
+    // Pre-flight checks
+    assert(ua->id[site] == site && ua->agg[site].sz == 1);
+
+    ua->agg[site].sum = weight;
+    ua->agg[site].attr_ct = 1;
+    ua->agg[site].min = attr;
+    ua->agg[site].max = attr;
+    ua->agg[site].flagged = flagged ? 1 : 0;
+}
+
+int ufagg_find(struct ufagg *ua, int p) {
+    /*
+     * Find the set representative of p, halving the path as we go
+     */
+    int         i;
+
+    if (p >= ua->site_cap) ufagg_grow(ua, p);
+
+    for (i = p; i != ua->id[i]; i = ua->id[i])
+        ua->id[i] = ua->id[ua->id[i]];
+
+    return i;
+}
+
+bool ufagg_union(struct ufagg *ua, int p, int q) {
+    /*
+     * Union the sets containing p and q, folding the aggregates of the
+     * smaller set's root into the larger set's root
+     *
+     * Returns:
+     *      true if p and q were in different sets
+     *      false if they were already connected
+     */
+    struct ufagg_val   *to, *from;
+    int                 i, j;
+
+    i = ufagg_find(ua, p);
+    j = ufagg_find(ua, q);
+
+    if (i == j) return false;
+
+    // Same choice of new root as Program 1.3
+    if (ua->agg[i].sz < ua->agg[j].sz) {
+        ua->id[i] = j;
+        to = &(ua->agg[j]);
+        from = &(ua->agg[i]);
+    } else {
+        ua->id[j] = i;
+        to = &(ua->agg[i]);
+        from = &(ua->agg[j]);
+    }
+
+    to->sz += from->sz;
+    to->sum += from->sum;
+    to->flagged += from->flagged;
+
+    // Sites without an attribute don't count towards min and max
+    if (from->attr_ct > 0) {
+        if (to->attr_ct == 0 || to->min > from->min) to->min = from->min;
+        if (to->attr_ct == 0 || to->max < from->max) to->max = from->max;
+        to->attr_ct += from->attr_ct;
+    }
+
+    return true;
+}
+
+const struct ufagg_val* ufagg_query(struct ufagg *ua, int p) {
+    /*
+     * Aggregates of the component containing p
+     */
+    return &(ua->agg[ufagg_find(ua, p)]);
+}
+
+void ufagg_load_attrs(struct ufagg *ua, char *path) {
+    /*
+     * Read "<site> <weight> <attribute> <flag>" lines from file at path
+     */
+    FILE       *fp;
+    int         site, attr, flag;
+    long long   weight;
+
+    fp = fopen(path, "r");
+
+    if (fp == NULL) {
+        perror("[ufagg_load_attrs] fopen");
+        exit(4);
+    }
+
+    while (fscanf(fp, "%d %lld %d %d\n", &site, &weight, &attr, &flag) == 4) {
+        if (site < 0) {
+            fprintf(stderr, "[ufagg_load_attrs] negative site id %d.\n", site);
+            exit(4);
+        }
+
+        ufagg_set(ua, site, weight, attr, flag != 0);
+    }
+
+    if (!feof(fp)) {
+        fprintf(stderr, "[ufagg_load_attrs] malformed line in %s.\n", path);
+        exit(4);
+    }
+
+    fclose(fp);
+}
+
+int main(int argc, char *argv[]) {
+    struct ufagg                ua;
+    const struct ufagg_val     *v;
+    char                        line[UFAGG_MAX_LINE];
+    char                       *attrs_path = NULL;
+    char                        trailing;
+    int                         p, q;
+
+    // Check args
+    for (int ai = 1; ai < argc; ai++) {
+        if (!strncmp(argv[ai], "--attrs=", 8))
+            attrs_path = argv[ai] + 8;
+        else {
+            fprintf(stderr, "Unexpected argument: %s. Exiting.\n", argv[ai]);
+            return 3;
+        }
+    }
+
+    memset(&ua, 0, sizeof(ua));
+    ufagg_grow(&ua, 0);
+
+    if (attrs_path)
+        ufagg_load_attrs(&ua, attrs_path);
+
+    while (fgets(line, sizeof(line), stdin) != NULL) {
+        if (sscanf(line, " ? %d %c", &p, &trailing) == 1 && p >= 0) {
+            // Query - O(alpha) via the root's aggregates, no scan of the sites
+            v = ufagg_query(&ua, p);
+
+            if (v->attr_ct > 0)
+                printf(" ? %d sz %d sum %lld min %d max %d flagged %d\n", p, v->sz, v->sum, v->min, v->max, v->flagged);
+            else
+                printf(" ? %d sz %d sum %lld min - max - flagged %d\n", p, v->sz, v->sum, v->flagged);
+        } else if (sscanf(line, "%d %d %c", &p, &q, &trailing) == 2 && p >= 0 && q >= 0) {
+            // Emit this connection if it is part of the spanning tree
+            if (ufagg_union(&ua, p, q))
+                printf(" %d %d\n", p, q);
+        } else if (strspn(line, " \t\r\n") != strlen(line)) {
+            fprintf(stderr, "Unexpected input: %s", line);
+            return 4;
+        }
+    }
+
+    // Clean up
+    free(ua.id);
+    free(ua.agg);
+
+    return 0;
+
+} // main()
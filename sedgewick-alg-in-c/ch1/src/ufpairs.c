@@ -0,0 +1,398 @@
+
+/* vim: set ts=8 sts=4 sw=4 et filetype=c: */
+
+#include <assert.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ufpairs.h"
+
+/*
+ ***************************************************************
+ * ufpairs.c    Pair array loading and site relabelling for    *
+ *              the connectivity programs                      *
+ *                                                             *
+ ***************************************************************
+ */
+
+
+static void *ufp_xmalloc_(size_t len, const char *who) {
+    void       *addr;
+
+    addr = malloc((len > 0) ? len : 1);
+
+    if (addr == NULL) {
+        perror(who);
+        exit(4);
+    }
+
+    return addr;
+}
+
+void ufp_load(struct ufpairs *up, FILE *fp) {
+    /*
+     * Read "p q" pairs from fp until EOF (or until something that isn't
+     * a pair turns up) into a growable pair array. Lines starting with '#'
+     * (e.g. the section headers written by uf --emit) are skipped.
+     *
+     * Asserts:
+     *      up is not NULL
+     *      fp is not NULL
+     */
+    int             p, q, c;
+    struct ufpair  *new_pair;
+    bool           *seen;
+
+    // Pre-flight checks
+    assert(up != NULL);
+    assert(fp != NULL);
+
+    // Initialize struct
+    memset(up, 0, sizeof(*up));
+    up->largest_seen = -1;
+    up->relabel = UFP_RELABEL_NONE;
+
+    up->cap = 1024;
+    up->pair = ufp_xmalloc_(up->cap * sizeof(struct ufpair), "[ufp_load] malloc");
+
+    while (true) {
+        // Skip comment lines
+        while ((c = getc(fp)) == '#') {
+            while ((c = getc(fp)) != EOF && c != '\n') ;
+        }
+        ungetc(c, fp);
+
+        if (fscanf(fp, "%d %d\n", &p, &q) != 2) break;
+
+        if (p < 0 || q < 0) {
+            fprintf(stderr, "[ufp_load] negative site id in pair %zu (%d %d).\n", up->ct, p, q);
+            exit(4);
+        }
+
+        // site_ct is largest_seen + 1, so INT_MAX itself can't be a site
+        if (p == INT_MAX || q == INT_MAX) {
+            fprintf(stderr, "[ufp_load] site id %d out of range.\n", INT_MAX);
+            exit(4);
+        }
+
+        // Grow pair array geometrically
+        if (up->ct == up->cap) {
+            new_pair = realloc(up->pair, (up->cap * 2) * sizeof(struct ufpair));
+
+            if (new_pair == NULL) {
+                perror("[ufp_load] realloc");
+                exit(4);
+            }
+
+            up->pair = new_pair;
+            up->cap *= 2;
+        }
+
+        up->pair[up->ct].p = p;
+        up->pair[up->ct].q = q;
+        up->ct++;
+
+        // Record largest seen
+        if (up->largest_seen < p) up->largest_seen = p;
+        if (up->largest_seen < q) up->largest_seen = q;
+    }
+
+    up->site_ct = up->largest_seen + 1;
+
+    // Count distinct sites
+    seen = ufp_xmalloc_((size_t)up->site_ct * sizeof(bool), "[ufp_load] malloc");
+    memset(seen, 0, (size_t)up->site_ct * sizeof(bool));
+
+    for (size_t k = 0; k < up->ct; k++) {
+        if (!seen[up->pair[k].p]) { seen[up->pair[k].p] = true; up->distinct_ct++; }
+        if (!seen[up->pair[k].q]) { seen[up->pair[k].q] = true; up->distinct_ct++; }
+    }
+
+    free(seen);
+}
+
+int ufp_parse_relabel(const char *name) {
+    /*
+     * Translate a relabelling strategy name, as given on the command line,
+     * into one of the UFP_RELABEL_* constants.
+     *
+     * Returns:
+     *      UFP_RELABEL_* constant on success
+     *      -1 if name is not recognised
+     */
+    if (!strcmp(name, "none"))
+        return UFP_RELABEL_NONE;
+    else if (!strcmp(name, "firsttouch") || !strcmp(name, "first-touch"))
+        return UFP_RELABEL_FIRSTTOUCH;
+    else if (!strcmp(name, "bfs"))
+        return UFP_RELABEL_BFS;
+    else if (!strcmp(name, "degree"))
+        return UFP_RELABEL_DEGREE;
+
+    return -1;
+}
+
+static int ufp_first_touch_(const struct ufpairs *up, int *order) {
+    /*
+     * Fill order[] with the distinct sites of the input in the order in
+     * which they first appear in the pair stream.
+     *
+     * Returns:
+     *      number of distinct sites written to order[]
+     */
+    bool       *seen;
+    int         ct = 0;
+    int         s;
+
+    seen = ufp_xmalloc_((size_t)up->site_ct * sizeof(bool), "[ufp_first_touch_] malloc");
+    memset(seen, 0, (size_t)up->site_ct * sizeof(bool));
+
+    for (size_t k = 0; k < up->ct; k++) {
+        s = up->pair[k].p;
+        if (!seen[s]) { seen[s] = true; order[ct++] = s; }
+
+        s = up->pair[k].q;
+        if (!seen[s]) { seen[s] = true; order[ct++] = s; }
+    }
+
+    free(seen);
+    return ct;
+}
+
+static void ufp_order_bfs_(const struct ufpairs *up, int *order, int ct) {
+    /*
+     * Reorder order[] (which holds the ct distinct sites in first-touch
+     * order) into breadth-first order over the graph described by the
+     * pairs, starting a new search from each not-yet-visited site in
+     * first-touch order, so that neighbouring sites end up with nearby ids.
+     */
+    int        *adj_start;
+    int        *adj;
+    int        *fill;
+    int        *queue;
+    bool       *visited;
+    int         head, tail, s, t;
+    size_t      n = (size_t)up->site_ct;
+
+    // Build adjacency lists in compressed sparse row form
+    adj_start = ufp_xmalloc_((n + 1) * sizeof(int), "[ufp_order_bfs_] malloc");
+    adj = ufp_xmalloc_(up->ct * 2 * sizeof(int), "[ufp_order_bfs_] malloc");
+    fill = ufp_xmalloc_(n * sizeof(int), "[ufp_order_bfs_] malloc");
+
+    memset(adj_start, 0, (n + 1) * sizeof(int));
+
+    for (size_t k = 0; k < up->ct; k++) {
+        adj_start[up->pair[k].p + 1]++;
+        adj_start[up->pair[k].q + 1]++;
+    }
+
+    for (size_t i = 0; i < n; i++)
+        adj_start[i + 1] += adj_start[i];
+
+    memcpy(fill, adj_start, n * sizeof(int));
+
+    for (size_t k = 0; k < up->ct; k++) {
+        adj[fill[up->pair[k].p]++] = up->pair[k].q;
+        adj[fill[up->pair[k].q]++] = up->pair[k].p;
+    }
+
+    free(fill);
+
+    // Breadth-first search, seeded in first-touch order
+    queue = ufp_xmalloc_((size_t)ct * sizeof(int), "[ufp_order_bfs_] malloc");
+    visited = ufp_xmalloc_(n * sizeof(bool), "[ufp_order_bfs_] malloc");
+    memset(visited, 0, n * sizeof(bool));
+
+    tail = 0;
+    for (int seed = 0; seed < ct; seed++) {
+        if (visited[order[seed]]) continue;
+
+        visited[order[seed]] = true;
+        queue[tail++] = order[seed];
+
+        for (head = tail - 1; head < tail; head++) {
+            s = queue[head];
+
+            for (int a = adj_start[s]; a < adj_start[s + 1]; a++) {
+                t = adj[a];
+                if (visited[t]) continue;
+                visited[t] = true;
+                queue[tail++] = t;
+            }
+        }
+    }
+
+    assert(tail == ct);
+    memcpy(order, queue, (size_t)ct * sizeof(int));
+
+    free(visited);
+    free(queue);
+    free(adj);
+    free(adj_start);
+}
+
+static void ufp_order_degree_(const struct ufpairs *up, int *order, int ct) {
+    /*
+     * Reorder order[] (which holds the ct distinct sites in first-touch
+     * order) by descending degree, so the hub sites of a scale-free graph
+     * - which most parent walks pass through - share a few cache lines.
+     * Counting sort, so ties stay in first-touch order.
+     */
+    int        *deg;
+    int        *bucket;
+    int        *sorted;
+    int         max_deg = 0;
+    size_t      n = (size_t)up->site_ct;
+
+    deg = ufp_xmalloc_(n * sizeof(int), "[ufp_order_degree_] malloc");
+    memset(deg, 0, n * sizeof(int));
+
+    for (size_t k = 0; k < up->ct; k++) {
+        deg[up->pair[k].p]++;
+        deg[up->pair[k].q]++;
+    }
+
+    for (int i = 0; i < ct; i++)
+        if (max_deg < deg[order[i]]) max_deg = deg[order[i]];
+
+    // bucket[d] is the output position of the next site with degree d,
+    // with buckets laid out from highest degree to lowest
+    bucket = ufp_xmalloc_(((size_t)max_deg + 2) * sizeof(int), "[ufp_order_degree_] malloc");
+    memset(bucket, 0, ((size_t)max_deg + 2) * sizeof(int));
+
+    for (int i = 0; i < ct; i++)
+        bucket[max_deg - deg[order[i]] + 1]++;
+
+    for (int d = 0; d <= max_deg; d++)
+        bucket[d + 1] += bucket[d];
+
+    sorted = ufp_xmalloc_((size_t)ct * sizeof(int), "[ufp_order_degree_] malloc");
+
+    for (int i = 0; i < ct; i++)
+        sorted[bucket[max_deg - deg[order[i]]]++] = order[i];
+
+    memcpy(order, sorted, (size_t)ct * sizeof(int));
+
+    free(sorted);
+    free(bucket);
+    free(deg);
+}
+
+void ufp_relabel(struct ufpairs *up, int relabel) {
+    /*
+     * Relabel the sites in the pair array so that sites which are used
+     * together get ids which are close together, and record the mapping
+     * in both directions so output can be reported in the original ids.
+     *
+     * Afterwards the site ids in up->pair are dense, in 0..(site_ct - 1).
+     *
+     * Asserts:
+     *      up is not NULL
+     *      up has not already been relabelled
+     */
+    int        *order;
+    int         ct;
+
+    // Pre-flight checks
+    assert(up != NULL);
+    assert(up->to_orig == NULL);
+
+    if (relabel == UFP_RELABEL_NONE) return;
+
+    // Every strategy starts from the first-touch order
+    order = ufp_xmalloc_((size_t)up->site_ct * sizeof(int), "[ufp_relabel] malloc");
+    ct = ufp_first_touch_(up, order);
+
+    switch (relabel) {
+        case UFP_RELABEL_FIRSTTOUCH:
+            break;
+        case UFP_RELABEL_BFS:
+            ufp_order_bfs_(up, order, ct);
+            break;
+        case UFP_RELABEL_DEGREE:
+            ufp_order_degree_(up, order, ct);
+            break;
+        default:
+            fprintf(stderr, "[ufp_relabel] invalid relabel strategy %d.\n", relabel);
+            abort();
+    }
+
+    // Build mapping tables
+    up->to_new = ufp_xmalloc_((size_t)up->site_ct * sizeof(int), "[ufp_relabel] malloc");
+
+    for (int i = 0; i < up->site_ct; i++)
+        up->to_new[i] = -1;
+
+    for (int i = 0; i < ct; i++)
+        up->to_new[order[i]] = i;
+
+    up->to_orig = order;
+
+    // Rewrite pairs
+    for (size_t k = 0; k < up->ct; k++) {
+        up->pair[k].p = up->to_new[up->pair[k].p];
+        up->pair[k].q = up->to_new[up->pair[k].q];
+    }
+
+    up->relabel = relabel;
+    up->site_ct = ct;
+}
+
+void ufp_dispose(struct ufpairs *up) {
+    /*
+     * Free pair array and any relabelling tables, and clear struct
+     *
+     * Asserts:
+     *      up is not NULL
+     */
+
+    // Pre-flight checks
+    assert(up != NULL);
+
+    free(up->pair);
+    free(up->to_orig);
+    free(up->to_new);
+
+    memset(up, 0, sizeof(*up));
+    up->largest_seen = -1;
+}
+
+int ufp_grow_cap(int cap, int site, const char *who) {
+    /*
+     * Capacity for a per-site array that must be indexable by site:
+     * cap (or 1024 if empty) doubled until it exceeds site, clamped to
+     * INT_MAX; shared by the programs that grow their arrays as site ids
+     * arrive, so none of them has to get the overflow case right alone
+     *
+     * A site id of INT_MAX cannot be held by an int-sized array, so it is
+     * reported against who and we exit
+     *
+     * Asserts:
+     *      who is not NULL
+     *      site is not negative
+     *
+     * Returns:
+     *      new capacity, greater than site
+     */
+
+    // Pre-flight checks
+    assert(who != NULL);
+    assert(site >= 0);
+
+    if (site == INT_MAX) {
+        fprintf(stderr, "%s site id %d out of range.\n", who, site);
+        exit(4);
+    }
+
+    if (cap <= 0)
+        cap = 1024;
+
+    while (cap <= site)
+        cap = (cap > INT_MAX / 2) ? INT_MAX : cap * 2;
+
+    return cap;
+}
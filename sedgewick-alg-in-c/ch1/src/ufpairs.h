@@ -0,0 +1,64 @@
+
+/* vim: set ts=8 sts=4 sw=4 et filetype=c: */
+
+#ifndef UFPAIRS_H
+#define UFPAIRS_H
+
+#include <stdio.h>
+
+/*
+ ***************************************************************
+ * ufpairs.h    Pair array loading and site relabelling for    *
+ *              the connectivity programs                      *
+ *                                                             *
+ ***************************************************************
+ */
+
+
+#define UFP_RELABEL_NONE        0
+#define UFP_RELABEL_FIRSTTOUCH  1
+#define UFP_RELABEL_BFS         2
+#define UFP_RELABEL_DEGREE      3
+
+struct ufpair {
+    int         p;
+    int         q;
+};
+
+struct ufpairs {
+    /* pair array, in input order */
+    struct ufpair  *pair;
+    size_t          ct;
+    size_t          cap;
+
+    /* largest site id seen in the input, -1 if there were no pairs, and
+     * how many distinct sites appear in a pair - ids in 0..largest_seen
+     * that never turn up aren't sites of the input, just gaps
+     */
+    int             largest_seen;
+    int             distinct_ct;
+
+    /* relabelling, only populated once ufp_relabel(...) has been called
+     * with something other than UFP_RELABEL_NONE
+     *
+     * site_ct is the number of sites the union-find arrays need to hold,
+     * which after relabelling is the number of distinct sites in the input
+     */
+    int             relabel;
+    int             site_ct;
+    int            *to_orig;        // new id -> original id
+    int            *to_new;         // original id -> new id, or -1 if unseen
+};
+
+void ufp_load(struct ufpairs *up, FILE *fp);
+int ufp_parse_relabel(const char *name);
+void ufp_relabel(struct ufpairs *up, int relabel);
+void ufp_dispose(struct ufpairs *up);
+int ufp_grow_cap(int cap, int site, const char *who);
+
+/* Map a (possibly relabelled) site id back to the id it had in the input */
+static inline int ufp_orig(const struct ufpairs *up, int site) {
+    return (up->to_orig != NULL) ? up->to_orig[site] : site;
+}
+
+#endif /* UFPAIRS_H */
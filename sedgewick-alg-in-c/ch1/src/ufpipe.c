@@ -0,0 +1,318 @@
+
+/* vim: set ts=8 sts=4 sw=4 et filetype=c: */
+
+#include <assert.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "sharkybuf.h"
+#include "sharkyring.h"
+#include "ufpairs.h"
+
+/*
+ ***************************************************************
+ * ufpipe.c     Weighted quick-union with path compression,    *
+ *              as a reader/union/writer thread pipeline       *
+ *                                                             *
+ * Source(s):   Algorithms in C, 3rd Ed., Robert Sedgewick     *
+ *              Chapter 1, Section 1.3, Program 1.3. (Page 17) *
+ *              Chapter 1, Section 1.3, Program 1.4. (Page 18) *
+ ***************************************************************
+ */
+
+// Usage: $0 [--slots=<n>] [--direct=<file>] < pairs
+
+#define UFPIPE_DEFAULT_SLOTS 16
+#define UFPIPE_MAX_LINE 32
+#define UFPIPE_DIRECT_BUF_LEN (1024 * 1024)
+
+
+struct ufpipe {
+    /* reader -> union thread, pages of raw input */
+    struct sharkyring   in_ring;
+    int                 in_fd;
+
+    /* union -> writer thread, pages of emitted pairs */
+    struct sharkyring   out_ring;
+    int                 out_fd;
+    struct sb_direct_sink *sink;        // if not NULL, written to instead of out_fd
+
+    /* union-find state, only touched by the union thread */
+    int                *id;
+    int                *sz;
+    int                 site_cap;
+
+    /* pair parser state, carried across page boundaries */
+    int                 field;
+    int                 val;
+    bool                in_num;
+    int                 p;
+};
+
+void *ufpipe_reader(void *arg) {
+    /*
+     * Fill input pages from in_fd as data arrives, and hand them to the
+     * union thread.
+     */
+    struct ufpipe      *up = arg;
+    struct sharkybuf   *sb;
+    int                 read_rv;
+
+    do {
+        sb = sr_produce_begin(&(up->in_ring));
+        read_rv = sb_recvbuf_read_avail(sb, up->in_fd);
+
+        if (sb->dirty)
+            sr_produce_commit(&(up->in_ring));
+    } while (read_rv == 0);
+
+    sr_produce_close(&(up->in_ring));
+    return NULL;
+}
+
+void *ufpipe_writer(void *arg) {
+    /*
+     * Drain output pages to out_fd, or to the O_DIRECT sink.
+     */
+    struct ufpipe      *up = arg;
+    struct sharkybuf   *sb;
+
+    while (sr_consume_begin(&(up->out_ring), &sb, true) == SHARKYRING_OK) {
+        if (up->sink)
+            sb_direct_write(up->sink, sb->addr, sb_content_len(sb));
+        else
+            sb_buf_to_fd(sb, up->out_fd);
+
+        sr_consume_commit(&(up->out_ring));
+    }
+
+    return NULL;
+}
+
+static void ufpipe_grow_(struct ufpipe *up, int site) {
+    /*
+     * Make sure the union-find arrays can hold site, initializing any
+     * new sites as singleton sets
+     */
+    int         new_cap;
+
+    new_cap = ufp_grow_cap(up->site_cap, site, "[ufpipe_grow_]");
+
+    up->id = realloc(up->id, (size_t)new_cap * sizeof(int));
+    up->sz = realloc(up->sz, (size_t)new_cap * sizeof(int));
+
+    if (up->id == NULL || up->sz == NULL) {
+        perror("[ufpipe_grow_] realloc");
+        exit(4);
+    }
+
+    for (int i = up->site_cap; i < new_cap; i++) {
+        up->id[i] = i;
+        up->sz[i] = 1;
+    }
+
+    up->site_cap = new_cap;
+}
+
+static char *ufpipe_fmt_int_(char *end, int v) {
+    /*
+     * Format non-negative v in decimal, right-aligned so that the last
+     * digit is written just before end. Returns pointer to first digit.
+     */
+    do {
+        *--end = (char)('0' + (v % 10));
+        v /= 10;
+    } while (v);
+
+    return end;
+}
+
+static struct sharkybuf *ufpipe_union_(struct ufpipe *up, struct sharkybuf *out, int p, int q) {
+    /*
+     * Union p and q, emitting the pair to out if they were not already
+     * connected. Returns the output page to use from now on.
+     */
+    int         i, j;
+    char        line[UFPIPE_MAX_LINE];
+    char       *line_p;
+
+    if (p >= up->site_cap || q >= up->site_cap)
+        ufpipe_grow_(up, (p > q) ? p : q);
+
+    // Find set representatives, halving paths as we go
+    for (i = p; i != up->id[i]; i = up->id[i])
+        up->id[i] = up->id[up->id[i]];
+    for (j = q; j != up->id[j]; j = up->id[j])
+        up->id[j] = up->id[up->id[j]];
+
+    if (i == j) return out;
+
+    if (up->sz[i] < up->sz[j]) {
+        up->id[i] = j;
+        up->sz[j] += up->sz[i];
+    } else {
+        up->id[j] = i;
+        up->sz[i] += up->sz[j];
+    }
+
+    // Emit this connection, it is part of the spanning tree
+    line_p = ufpipe_fmt_int_(&line[UFPIPE_MAX_LINE], q);
+    *--line_p = ' ';
+    line_p = ufpipe_fmt_int_(line_p, p);
+    *--line_p = ' ';
+
+    while (sb_append_record(out, line_p, (size_t)(&line[UFPIPE_MAX_LINE] - line_p), '\n') != 0) {
+        // Page full, hand it to the writer and carry on in a fresh one
+        sr_produce_commit(&(up->out_ring));
+        out = sr_produce_begin(&(up->out_ring));
+    }
+
+    return out;
+}
+
+static struct sharkybuf *ufpipe_end_num_(struct ufpipe *up, struct sharkybuf *out) {
+    /*
+     * A number has just ended in the input - either remember it as p,
+     * or union it with p as q
+     */
+    up->in_num = false;
+
+    if (up->field == 0) {
+        up->p = up->val;
+        up->field = 1;
+    } else {
+        out = ufpipe_union_(up, out, up->p, up->val);
+        up->field = 0;
+    }
+
+    up->val = 0;
+    return out;
+}
+
+void *ufpipe_union(void *arg) {
+    /*
+     * Parse "p q" pairs out of the input pages and run them through
+     * weighted quick-union, emitting spanning tree edges to output pages.
+     * Whenever the input runs dry the current output page is handed over
+     * early, so that output from a live stream isn't held back.
+     */
+    struct ufpipe      *up = arg;
+    struct sharkybuf   *in;
+    struct sharkybuf   *out;
+    const char         *c, *end;
+    int                 rv, d;
+
+    out = sr_produce_begin(&(up->out_ring));
+
+    while (true) {
+        rv = sr_consume_begin(&(up->in_ring), &in, false);
+
+        if (rv == SHARKYRING_EMPTY) {
+            if (out->dirty) {
+                sr_produce_commit(&(up->out_ring));
+                out = sr_produce_begin(&(up->out_ring));
+            }
+            rv = sr_consume_begin(&(up->in_ring), &in, true);
+        }
+
+        if (rv == SHARKYRING_EOF) break;
+
+        end = in->writer_ptr;
+        for (c = in->addr; c < end; c++) {
+            if (*c >= '0' && *c <= '9') {
+                d = *c - '0';
+                if (up->val > (INT_MAX - d) / 10) {
+                    fprintf(stderr, "[ufpipe_union] site id out of range.\n");
+                    exit(4);
+                }
+                up->val = (up->val * 10) + d;
+                up->in_num = true;
+            } else if (*c == ' ' || *c == '\n' || *c == '\t' || *c == '\r') {
+                if (up->in_num)
+                    out = ufpipe_end_num_(up, out);
+            } else {
+                fprintf(stderr, "[ufpipe_union] unexpected character 0x%02x in input.\n", (unsigned char)*c);
+                exit(4);
+            }
+        }
+
+        sr_consume_commit(&(up->in_ring));
+    }
+
+    // Input may end without a trailing newline
+    if (up->in_num)
+        out = ufpipe_end_num_(up, out);
+
+    if (out->dirty)
+        sr_produce_commit(&(up->out_ring));
+
+    sr_produce_close(&(up->out_ring));
+    return NULL;
+}
+
+int main(int argc, char *argv[]) {
+    struct ufpipe       up;
+    pthread_t           reader, writer;
+    unsigned            slot_ct = UFPIPE_DEFAULT_SLOTS;
+    size_t              page_size;
+    char               *direct_path = NULL;
+    struct sb_direct_sink sink;
+
+    // Check args
+    for (int ai = 1; ai < argc; ai++) {
+        if (!strncmp(argv[ai], "--slots=", 8)) {
+            slot_ct = (unsigned)atoi(argv[ai] + 8);
+            if (slot_ct == 0 || (slot_ct & (slot_ct - 1)) != 0) {
+                fprintf(stderr, "Slot count must be a power of two. Exiting.\n");
+                return 3;
+            }
+        } else if (!strncmp(argv[ai], "--direct=", 9)) {
+            // Write output to a file with O_DIRECT, keeping it out of the page cache
+            direct_path = argv[ai] + 9;
+        } else {
+            fprintf(stderr, "Unexpected argument: %s. Exiting.\n", argv[ai]);
+            return 3;
+        }
+    }
+
+    memset(&up, 0, sizeof(up));
+    up.in_fd = fileno(stdin);
+    up.out_fd = fileno(stdout);
+
+    if (direct_path) {
+        sb_direct_open(&sink, direct_path, UFPIPE_DIRECT_BUF_LEN);
+        up.sink = &sink;
+    }
+
+    page_size = (size_t)sysconf(_SC_PAGESIZE);
+    sr_create(&(up.in_ring), slot_ct, page_size);
+    sr_create(&(up.out_ring), slot_ct, page_size);
+
+    // Reader and writer run on their own threads, union core runs on ours
+    if (pthread_create(&reader, NULL, ufpipe_reader, &up) != 0 ||
+        pthread_create(&writer, NULL, ufpipe_writer, &up) != 0) {
+        fprintf(stderr, "pthread_create failed.\n");
+        exit(4);
+    }
+
+    ufpipe_union(&up);
+
+    pthread_join(reader, NULL);
+    pthread_join(writer, NULL);
+
+    // Clean up
+    if (up.sink) sb_direct_close(up.sink);
+    sr_dispose(&(up.out_ring));
+    sr_dispose(&(up.in_ring));
+    free(up.id);
+    free(up.sz);
+
+    return 0;
+
+} // main()
@@ -0,0 +1,100 @@
+
+/* vim: set ts=8 sts=4 sw=4 et filetype=c: */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "sharkybuf.h"
+#include "bench.h"
+
+#define BENCH_MIN_OPS           64
+
+/*
+ ***************************************************************
+ * alloc.c      Benchmark sharkybuf creation and disposal, by  *
+ *              strategy and buffer size                       *
+ *                                                             *
+ ***************************************************************
+ */
+
+// Usage: $0 [total MiB]
+//
+// For each strategy and size, create and dispose of buffers until total
+// MiB of buffer have been handed out - once touching only the first
+// page, as a mostly-empty buffer would be, and once filling every byte.
+// CSV on stdout.
+
+
+static const size_t bench_lens[] = { 4096, 64 * 1024, BENCH_MIB, 4 * BENCH_MIB };
+
+static const struct {
+    int             strategy;
+    const char     *name;
+} bench_strategies[] = {
+    { SHARKYBUF_STRATEGY_MMAP,           "mmap" },
+    { SHARKYBUF_STRATEGY_POSIX_MEMALIGN, "posix_memalign" },
+    { SHARKYBUF_STRATEGY_MALLOC,         "malloc" },
+};
+
+static char bench_fill[4 * BENCH_MIB];
+
+static void bench_run(int strategy, const char *name, size_t len, bool fill, size_t total_len) {
+    struct sharkybuf        sb;
+    unsigned long long      start_ns, op_ct;
+    char                    variant[64];
+
+    op_ct = total_len / len;
+    if (op_ct < BENCH_MIN_OPS) op_ct = BENCH_MIN_OPS;
+
+    start_ns = bench_now_ns();
+
+    for (unsigned long long i = 0; i < op_ct; i++) {
+        switch (strategy) {
+            case SHARKYBUF_STRATEGY_MMAP:
+                sb_create_mmap(&sb, len);
+                break;
+            case SHARKYBUF_STRATEGY_POSIX_MEMALIGN:
+                sb_create_posix_memalign(&sb, len);
+                break;
+            case SHARKYBUF_STRATEGY_MALLOC:
+                sb_create_malloc(&sb, len);
+                break;
+            default:
+                abort();
+        }
+
+        sb_append_bytes(&sb, bench_fill, fill ? len : 1);
+        sb_dispose(&sb);
+    }
+
+    snprintf(variant, sizeof(variant), "%s/%s", name, fill ? "fill" : "touch");
+    bench_csv_row("alloc", variant, len, 1, op_ct, fill ? op_ct * len : 0, bench_now_ns() - start_ns);
+}
+
+int main(int argc, char *argv[]) {
+    int     total_mib;
+
+    total_mib = (argc > 1) ? atoi(argv[1]) : BENCH_DEFAULT_TOTAL_MIB;
+
+    if (argc > 2 || total_mib < 1) {
+        fprintf(stderr, "Usage: %s [total MiB]\n", argv[0]);
+        return 3;
+    }
+
+    memset(bench_fill, 'x', sizeof(bench_fill));
+    bench_csv_header();
+
+    for (size_t l = 0; l < sizeof(bench_lens) / sizeof(bench_lens[0]); l++) {
+        for (size_t s = 0; s < sizeof(bench_strategies) / sizeof(bench_strategies[0]); s++) {
+            bench_run(bench_strategies[s].strategy, bench_strategies[s].name, bench_lens[l], false,
+                      (size_t)total_mib * BENCH_MIB);
+            bench_run(bench_strategies[s].strategy, bench_strategies[s].name, bench_lens[l], true,
+                      (size_t)total_mib * BENCH_MIB);
+        }
+    }
+
+    return 0;
+}
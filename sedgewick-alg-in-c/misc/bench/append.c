@@ -0,0 +1,124 @@
+
+/* vim: set ts=8 sts=4 sw=4 et filetype=c: */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sharkybuf.h"
+#include "bench.h"
+
+#define BENCH_CHUNK_LEN         64          /* bytes per append for the "bytes" variant */
+
+/*
+ ***************************************************************
+ * append.c     Benchmark appending records to sharkybufs of   *
+ *              different sizes                                *
+ *                                                             *
+ ***************************************************************
+ */
+
+// Usage: $0 [total MiB]
+//
+// For each sb_append_* flavour and buffer size, append records until
+// total MiB have been appended, wiping the buffer whenever it fills - as
+// the sharky generator does - so the cost of sb_wipe(...) is included.
+// CSV on stdout.
+
+
+static const size_t bench_lens[] = { 4096, 64 * 1024, BENCH_MIB };
+
+enum bench_variant {
+    BENCH_RECORD,
+    BENCH_LINE,
+    BENCH_U64,
+    BENCH_U32,
+    BENCH_BYTES,
+    BENCH_VARIANT_CT
+};
+
+static const char *bench_variant_names[BENCH_VARIANT_CT] = {
+    "record", "line", "u64", "u32", "bytes"
+};
+
+static const char bench_chunk[BENCH_CHUNK_LEN] =
+    "0123456789abcdef0123456789abcdef0123456789abcdef0123456789abcde";
+
+static bool bench_append(struct sharkybuf *sb, enum bench_variant v, uint64_t i, size_t *len) {
+    /*
+     * Append one record of flavour v to sb
+     *
+     * Returns:
+     *      true, with its length in *len, if it fitted
+     *      false if it didn't
+     */
+    char       *before = sb->writer_ptr;
+
+    switch (v) {
+        case BENCH_RECORD:
+            if (sb_append_record(sb, "abcdefg", 7, '\n')) return false;
+            break;
+        case BENCH_LINE:
+            if (sb_append_line(sb, "abcdefg")) return false;
+            break;
+        case BENCH_U64:
+            if (sb_append_u64(sb, i, '\n')) return false;
+            break;
+        case BENCH_U32:
+            if (sb_append_u32(sb, (uint32_t)i, '\n')) return false;
+            break;
+        case BENCH_BYTES:
+            if (sb->writer_len_remaining < sizeof(bench_chunk)) return false;
+            sb_append_bytes(sb, bench_chunk, sizeof(bench_chunk));
+            break;
+        default:
+            abort();
+    }
+
+    *len = (size_t)(sb->writer_ptr - before);
+    return true;
+}
+
+static void bench_run(enum bench_variant v, size_t buf_len, size_t total_len) {
+    struct sharkybuf        sb;
+    unsigned long long      start_ns, op_ct = 0, byte_ct = 0;
+    size_t                  len;
+
+    sb_create_mmap(&sb, buf_len);
+
+    start_ns = bench_now_ns();
+
+    while (byte_ct < total_len) {
+        if (bench_append(&sb, v, op_ct, &len)) {
+            op_ct++;
+            byte_ct += len;
+        } else {
+            sb_wipe(&sb);
+        }
+    }
+
+    bench_csv_row("append", bench_variant_names[v], buf_len, 1, op_ct, byte_ct, bench_now_ns() - start_ns);
+
+    sb_dispose(&sb);
+}
+
+int main(int argc, char *argv[]) {
+    int     total_mib;
+
+    total_mib = (argc > 1) ? atoi(argv[1]) : BENCH_DEFAULT_TOTAL_MIB;
+
+    if (argc > 2 || total_mib < 1) {
+        fprintf(stderr, "Usage: %s [total MiB]\n", argv[0]);
+        return 3;
+    }
+
+    bench_csv_header();
+
+    for (size_t l = 0; l < sizeof(bench_lens) / sizeof(bench_lens[0]); l++)
+        for (int v = 0; v < BENCH_VARIANT_CT; v++)
+            bench_run((enum bench_variant)v, bench_lens[l], (size_t)total_mib * BENCH_MIB);
+
+    return 0;
+}
@@ -0,0 +1,52 @@
+
+/* vim: set ts=8 sts=4 sw=4 et filetype=c: */
+
+#ifndef BENCH_H
+#define BENCH_H
+
+/*
+ ***************************************************************
+ * bench.h      Timing and CSV output shared by the sharkybuf  *
+ *              microbenchmarks                                *
+ *                                                             *
+ ***************************************************************
+ */
+
+#include <stdio.h>
+#include <time.h>
+
+// Optimisation level the bench and the library were built at, from the Makefile
+#ifndef BENCH_OPT
+#define BENCH_OPT               "unknown"
+#endif
+
+#define BENCH_MIB               (1024 * 1024)
+#define BENCH_DEFAULT_TOTAL_MIB 256         /* bytes each run moves, unless told otherwise */
+
+static inline unsigned long long bench_now_ns(void) {
+    struct timespec     ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((unsigned long long)ts.tv_sec * 1000000000ULL) + (unsigned long long)ts.tv_nsec;
+}
+
+static inline void bench_csv_header(void) {
+    printf("bench,variant,buf_len,threads,ops,bytes,ns,ns_per_op,mib_per_s,opt\n");
+}
+
+static inline void bench_csv_row(const char *bench, const char *variant, size_t buf_len, int thread_ct,
+                                 unsigned long long op_ct, unsigned long long byte_ct,
+                                 unsigned long long elapsed_ns) {
+    /*
+     * One CSV row per run: elapsed_ns is wall-clock time for the whole
+     * run, and ns_per_op is per thread - the time each op took the thread
+     * doing it. byte_ct may be 0 for runs that don't move data.
+     */
+    printf("%s,%s,%zu,%d,%llu,%llu,%llu,%.1f,%.1f,%s\n",
+           bench, variant, buf_len, thread_ct, op_ct, byte_ct, elapsed_ns,
+           (double)elapsed_ns / (double)op_ct * (double)thread_ct,
+           ((double)byte_ct / BENCH_MIB) / ((double)elapsed_ns / 1e9), BENCH_OPT);
+    fflush(stdout);
+}
+
+#endif /* BENCH_H */
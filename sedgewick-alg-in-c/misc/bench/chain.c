@@ -0,0 +1,195 @@
+
+/* vim: set ts=8 sts=4 sw=4 et filetype=c: */
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "sharkybuf.h"
+#include "bench.h"
+
+#define BENCH_RECORD_LEN        64          /* bytes per append */
+#define BENCH_OUTPUT_LEN        (16 * BENCH_MIB)    /* bytes built up before each flush */
+
+/*
+ ***************************************************************
+ * chain.c      Benchmark building up large outputs: one page  *
+ *              flushed as it fills, a growing buffer, or an   *
+ *              sb_chain, optionally handed to a writer thread *
+ *                                                             *
+ ***************************************************************
+ */
+
+// Usage: $0 [total MiB]
+//
+// Each run appends records until an output of BENCH_OUTPUT_LEN has been
+// built up, sends it to /dev/null, and goes again until total MiB have
+// been appended. buf_len is the size of a page, of the buffer's first
+// allocation, or of a chain link, by variant:
+//
+//      flush       one buffer, written out with write(2) each time it fills
+//      realloc     a new buffer per output, doubled with sb_realloc(...)
+//      chain       sb_chain_append_bytes(...), then one sb_chain_writev(...)
+//      handoff     as chain, but posted through an sb_chain_handoff to a
+//                  writer thread, which does the sb_chain_writev(...)
+//
+// CSV on stdout.
+
+
+static const size_t bench_lens[] = { 4096, 64 * 1024, BENCH_MIB };
+
+enum bench_variant {
+    BENCH_FLUSH,
+    BENCH_REALLOC,
+    BENCH_CHAIN,
+    BENCH_HANDOFF,
+    BENCH_VARIANT_CT
+};
+
+static const char *bench_variant_names[BENCH_VARIANT_CT] = {
+    "flush", "realloc", "chain", "handoff"
+};
+
+static const char bench_record[BENCH_RECORD_LEN] =
+    "0123456789abcdef0123456789abcdef0123456789abcdef0123456789abcde";
+
+struct bench_writer {
+    struct sb_chain_handoff     handoff;
+    size_t                      page_len;
+    int                         null_fd;
+};
+
+static void *bench_writer(void *arg) {
+    struct bench_writer    *w = arg;
+    struct sb_chain         out;
+
+    sb_chain_init(&out, w->page_len);
+
+    while (sb_chain_handoff_take(&(w->handoff), &out, true) == 0)
+        sb_chain_writev(&out, w->null_fd);
+
+    sb_chain_dispose(&out);
+    return NULL;
+}
+
+static void bench_run(enum bench_variant v, size_t buf_len, size_t total_len, int null_fd) {
+    struct sharkybuf        sb;
+    struct sb_chain         ch;
+    struct bench_writer     w;
+    pthread_t               writer;
+    unsigned long long      start_ns, op_ct = 0, byte_ct = 0;
+    size_t                  out_len;
+
+    if (v == BENCH_FLUSH)
+        sb_create_mmap(&sb, buf_len);
+    else
+        sb_chain_init(&ch, buf_len);
+
+    if (v == BENCH_HANDOFF) {
+        sb_chain_handoff_init(&(w.handoff));
+        w.page_len = buf_len;
+        w.null_fd = null_fd;
+
+        if (pthread_create(&writer, NULL, bench_writer, &w) != 0) {
+            fprintf(stderr, "[bench_run] pthread_create failed.\n");
+            exit(4);
+        }
+    }
+
+    start_ns = bench_now_ns();
+
+    while (byte_ct < total_len) {
+        if (v == BENCH_REALLOC)
+            sb_create_malloc(&sb, buf_len);
+
+        for (out_len = 0; out_len < BENCH_OUTPUT_LEN; out_len += sizeof(bench_record)) {
+            switch (v) {
+                case BENCH_FLUSH:
+                    if (sb.writer_len_remaining < sizeof(bench_record)) {
+                        sb_buf_to_fd(&sb, null_fd);
+                        sb_rewind(&sb);
+                    }
+                    sb_append_bytes(&sb, bench_record, sizeof(bench_record));
+                    break;
+                case BENCH_REALLOC:
+                    if (sb.writer_len_remaining < sizeof(bench_record))
+                        sb_realloc(&sb, sb.len * 2);
+                    sb_append_bytes(&sb, bench_record, sizeof(bench_record));
+                    break;
+                case BENCH_CHAIN:
+                case BENCH_HANDOFF:
+                    sb_chain_append_bytes(&ch, bench_record, sizeof(bench_record));
+                    break;
+                default:
+                    abort();
+            }
+
+            op_ct++;
+        }
+
+        switch (v) {
+            case BENCH_FLUSH:
+                sb_buf_to_fd(&sb, null_fd);
+                sb_rewind(&sb);
+                break;
+            case BENCH_REALLOC:
+                sb_buf_to_fd(&sb, null_fd);
+                sb_dispose(&sb);
+                break;
+            case BENCH_CHAIN:
+                sb_chain_writev(&ch, null_fd);
+                break;
+            case BENCH_HANDOFF:
+                sb_chain_handoff_post(&(w.handoff), &ch);
+                break;
+            default:
+                abort();
+        }
+
+        byte_ct += out_len;
+    }
+
+    if (v == BENCH_HANDOFF) {
+        sb_chain_handoff_close(&(w.handoff));
+        pthread_join(writer, NULL);
+        sb_chain_handoff_destroy(&(w.handoff));
+    }
+
+    // The writer thread only does the writev(2), so ns_per_op is per append
+    bench_csv_row("chain", bench_variant_names[v], buf_len, 1, op_ct, byte_ct, bench_now_ns() - start_ns);
+
+    if (v == BENCH_FLUSH)
+        sb_dispose(&sb);
+    else
+        sb_chain_dispose(&ch);
+}
+
+int main(int argc, char *argv[]) {
+    int     total_mib;
+    int     null_fd;
+
+    total_mib = (argc > 1) ? atoi(argv[1]) : BENCH_DEFAULT_TOTAL_MIB;
+
+    if (argc > 2 || total_mib < 1) {
+        fprintf(stderr, "Usage: %s [total MiB]\n", argv[0]);
+        return 3;
+    }
+
+    if ((null_fd = open("/dev/null", O_WRONLY)) == -1) {
+        perror("/dev/null");
+        exit(4);
+    }
+
+    bench_csv_header();
+
+    for (size_t l = 0; l < sizeof(bench_lens) / sizeof(bench_lens[0]); l++)
+        for (int v = 0; v < BENCH_VARIANT_CT; v++)
+            bench_run((enum bench_variant)v, bench_lens[l], (size_t)total_mib * BENCH_MIB, null_fd);
+
+    close(null_fd);
+    return 0;
+}
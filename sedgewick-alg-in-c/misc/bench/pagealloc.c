@@ -0,0 +1,178 @@
+
+/* vim: set ts=8 sts=4 sw=4 et filetype=c: */
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "sharkybuf.h"
+#include "bench.h"
+
+#define BENCH_DEFAULT_THREADS   32
+#define BENCH_DEFAULT_ROUNDS    200
+#define BENCH_BATCH             64          /* buffers held by each thread per round */
+#define BENCH_MAX_THREADS       256
+
+/*
+ ***************************************************************
+ * pagealloc.c  Benchmark one-page sharkybuf creation and      *
+ *              disposal under many-thread contention          *
+ *                                                             *
+ ***************************************************************
+ */
+
+// Usage: $0 [threads] [rounds]
+//
+// Each round, every thread creates BENCH_BATCH one-page buffers and
+// writes to them; after a barrier, each thread disposes of the buffers
+// its neighbour created - as a consumer thread would - so allocators get
+// no help from freeing on the allocating thread. CSV on stdout.
+
+
+struct bench {
+    int                     strategy;
+    int                     thread_ct;
+    int                     round_ct;
+    size_t                  page_len;
+    struct sb_pagealloc     pa;
+    pthread_barrier_t       barrier;
+    struct sharkybuf      (*bufs)[BENCH_BATCH];     // [thread_ct][BENCH_BATCH]
+};
+
+struct bench_thread {
+    struct bench           *b;
+    int                     id;
+    pthread_t               thread;
+};
+
+static const char *bench_strategy_name(int strategy) {
+    switch (strategy) {
+        case SHARKYBUF_STRATEGY_MMAP:           return "mmap";
+        case SHARKYBUF_STRATEGY_POSIX_MEMALIGN: return "posix_memalign";
+        case SHARKYBUF_STRATEGY_MALLOC:         return "malloc";
+        case SHARKYBUF_STRATEGY_PAGECACHE:      return "pagecache";
+        default:                                abort();
+    }
+}
+
+static void *bench_thread_main(void *arg) {
+    struct bench_thread    *bt = arg;
+    struct bench           *b = bt->b;
+    struct sharkybuf       *mine = b->bufs[bt->id];
+    struct sharkybuf       *theirs = b->bufs[(bt->id + 1) % b->thread_ct];
+    struct sb_pagecache     pc;
+
+    sb_pagecache_init(&pc, &(b->pa));
+    sb_pagecache_bind(&pc);
+
+    for (int r = 0; r < b->round_ct; r++) {
+        for (int i = 0; i < BENCH_BATCH; i++) {
+            switch (b->strategy) {
+                case SHARKYBUF_STRATEGY_MMAP:
+                    sb_create_mmap(&mine[i], b->page_len);
+                    break;
+                case SHARKYBUF_STRATEGY_POSIX_MEMALIGN:
+                    sb_create_posix_memalign(&mine[i], b->page_len);
+                    break;
+                case SHARKYBUF_STRATEGY_MALLOC:
+                    sb_create_malloc(&mine[i], b->page_len);
+                    break;
+                case SHARKYBUF_STRATEGY_PAGECACHE:
+                    sb_create_pagecache(&mine[i], &pc);
+                    break;
+            }
+
+            sb_append_record(&mine[i], "x", 1, '\n');
+        }
+
+        pthread_barrier_wait(&(b->barrier));
+
+        for (int i = 0; i < BENCH_BATCH; i++)
+            sb_dispose(&theirs[i]);
+
+        pthread_barrier_wait(&(b->barrier));
+    }
+
+    sb_pagecache_flush(&pc);
+    sb_pagecache_bind(NULL);
+
+    return NULL;
+}
+
+static void bench_run(struct bench *b, int strategy) {
+    struct bench_thread     bt[BENCH_MAX_THREADS];
+    unsigned long long      start_ns, elapsed_ns, op_ct;
+
+    b->strategy = strategy;
+
+    if (strategy == SHARKYBUF_STRATEGY_PAGECACHE) {
+        // Enough for every thread's buffers plus a full cache each
+        sb_pagealloc_init(&(b->pa), b->page_len,
+                          (uint32_t)b->thread_ct * (BENCH_BATCH + SB_PAGECACHE_MAX + SB_PAGECACHE_BATCH));
+    }
+
+    pthread_barrier_init(&(b->barrier), NULL, (unsigned)b->thread_ct);
+
+    start_ns = bench_now_ns();
+
+    for (int t = 0; t < b->thread_ct; t++) {
+        bt[t].b = b;
+        bt[t].id = t;
+
+        if (pthread_create(&bt[t].thread, NULL, bench_thread_main, &bt[t]) != 0) {
+            fprintf(stderr, "[bench_run] pthread_create failed.\n");
+            exit(4);
+        }
+    }
+
+    for (int t = 0; t < b->thread_ct; t++)
+        pthread_join(bt[t].thread, NULL);
+
+    elapsed_ns = bench_now_ns() - start_ns;
+    op_ct = (unsigned long long)b->thread_ct * (unsigned long long)b->round_ct * BENCH_BATCH;
+
+    pthread_barrier_destroy(&(b->barrier));
+
+    if (strategy == SHARKYBUF_STRATEGY_PAGECACHE)
+        sb_pagealloc_destroy(&(b->pa));
+
+    bench_csv_row("pagealloc", bench_strategy_name(strategy), b->page_len, b->thread_ct, op_ct, 0, elapsed_ns);
+}
+
+int main(int argc, char *argv[]) {
+    struct bench    b;
+    static const int strategies[] = {
+        SHARKYBUF_STRATEGY_MMAP,
+        SHARKYBUF_STRATEGY_POSIX_MEMALIGN,
+        SHARKYBUF_STRATEGY_MALLOC,
+        SHARKYBUF_STRATEGY_PAGECACHE,
+    };
+
+    memset(&b, 0, sizeof(b));
+    b.thread_ct = (argc > 1) ? atoi(argv[1]) : BENCH_DEFAULT_THREADS;
+    b.round_ct = (argc > 2) ? atoi(argv[2]) : BENCH_DEFAULT_ROUNDS;
+    b.page_len = (size_t)sysconf(_SC_PAGESIZE);
+
+    if (argc > 3 || b.thread_ct < 1 || b.thread_ct > BENCH_MAX_THREADS || b.round_ct < 1) {
+        fprintf(stderr, "Usage: %s [threads (1-%d)] [rounds]\n", argv[0], BENCH_MAX_THREADS);
+        return 3;
+    }
+
+    b.bufs = calloc((size_t)b.thread_ct, sizeof(*b.bufs));
+
+    if (b.bufs == NULL) {
+        perror("calloc");
+        exit(4);
+    }
+
+    bench_csv_header();
+
+    for (size_t s = 0; s < sizeof(strategies) / sizeof(strategies[0]); s++)
+        bench_run(&b, strategies[s]);
+
+    free(b.bufs);
+    return 0;
+}
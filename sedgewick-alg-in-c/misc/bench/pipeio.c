@@ -0,0 +1,160 @@
+
+/* vim: set ts=8 sts=4 sw=4 et filetype=c: */
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "sharkybuf.h"
+#include "bench.h"
+
+#define BENCH_PIPE_LEN          BENCH_MIB
+
+/*
+ ***************************************************************
+ * pipeio.c     Benchmark moving framed sharkybufs through a   *
+ *              pipe, by transport and buffer size             *
+ *                                                             *
+ ***************************************************************
+ */
+
+// Usage: $0 [total MiB]
+//
+// A producer thread fills framed buffers and sends them down a pipe with
+// write(2) (sb_buf_to_fd) or vmsplice(2) (sb_sendbuf_vmsplice); a
+// consumer thread passes their payloads on to /dev/null, either reading
+// them in (sb_recvbuf_read, then sb_frame_payload_to_fd - the
+// sb_buf_to_stdout path) or with splice(2) (sb_splice_frames_to_fd).
+// CSV on stdout.
+
+
+static const size_t bench_lens[] = { 4096, 16 * 1024, 64 * 1024, 256 * 1024, BENCH_MIB };
+
+struct bench {
+    size_t                  buf_len;
+    unsigned long long      frame_ct;
+    bool                    vmsplice;
+    bool                    splice;
+    int                     fd[2];
+    int                     null_fd;
+};
+
+static char bench_fill[BENCH_MIB];
+
+static void *bench_consumer(void *arg) {
+    struct bench       *b = arg;
+    struct sharkybuf    rx;
+    int                 eof = 0;
+
+    if (b->splice) {
+        sb_splice_frames_to_fd(b->fd[0], b->null_fd, b->buf_len);
+        return NULL;
+    }
+
+    sb_create_mmap(&rx, b->buf_len);
+
+    while (!eof) {
+        eof = sb_recvbuf_read(&rx, b->fd[0]);
+
+        if (rx.writer_len_remaining == 0) {
+            sb_frame_payload_to_fd(&rx, b->null_fd);
+            sb_rewind(&rx);
+        }
+    }
+
+    sb_dispose(&rx);
+    return NULL;
+}
+
+static void bench_producer(struct bench *b) {
+    struct sharkybuf    tx;
+
+    sb_create_mmap(&tx, b->buf_len);
+    sb_frame_init(&tx);
+
+    for (unsigned long long i = 0; i < b->frame_ct; i++) {
+        sb_append_bytes(&tx, bench_fill, tx.writer_len_remaining);
+
+        if (b->vmsplice) {
+            // Gifts the pages, and gives us a fresh framed buffer
+            sb_sendbuf_vmsplice(&tx, b->fd[1]);
+        } else {
+            sb_frame_seal(&tx);
+            sb_buf_to_fd(&tx, b->fd[1]);
+            sb_frame_init(&tx);
+        }
+    }
+
+    sb_dispose(&tx);
+}
+
+static void bench_run(size_t buf_len, bool vmsplice, bool splice, size_t total_len) {
+    struct bench            b;
+    pthread_t               consumer;
+    unsigned long long      start_ns, elapsed_ns;
+    char                    variant[64];
+
+    b.buf_len = buf_len;
+    b.frame_ct = (total_len + buf_len - 1) / buf_len;
+    b.vmsplice = vmsplice;
+    b.splice = splice;
+
+    if (pipe(b.fd) == -1) {
+        perror("pipe");
+        exit(4);
+    }
+
+    sb_pipe_set_size(b.fd[1], BENCH_PIPE_LEN);
+
+    if ((b.null_fd = open("/dev/null", O_WRONLY)) == -1) {
+        perror("/dev/null");
+        exit(4);
+    }
+
+    start_ns = bench_now_ns();
+
+    if (pthread_create(&consumer, NULL, bench_consumer, &b) != 0) {
+        fprintf(stderr, "[bench_run] pthread_create failed.\n");
+        exit(4);
+    }
+
+    bench_producer(&b);
+    close(b.fd[1]);
+    pthread_join(consumer, NULL);
+
+    elapsed_ns = bench_now_ns() - start_ns;
+
+    close(b.fd[0]);
+    close(b.null_fd);
+
+    snprintf(variant, sizeof(variant), "%s+%s", vmsplice ? "vmsplice" : "write", splice ? "splice" : "read");
+    // Every frame goes through both threads, so ns_per_op is per frame
+    bench_csv_row("pipeio", variant, buf_len, 1, b.frame_ct, b.frame_ct * buf_len, elapsed_ns);
+}
+
+int main(int argc, char *argv[]) {
+    int     total_mib;
+
+    total_mib = (argc > 1) ? atoi(argv[1]) : BENCH_DEFAULT_TOTAL_MIB;
+
+    if (argc > 2 || total_mib < 1) {
+        fprintf(stderr, "Usage: %s [total MiB]\n", argv[0]);
+        return 3;
+    }
+
+    memset(bench_fill, 'x', sizeof(bench_fill));
+    bench_csv_header();
+
+    for (size_t l = 0; l < sizeof(bench_lens) / sizeof(bench_lens[0]); l++) {
+        bench_run(bench_lens[l], false, false, (size_t)total_mib * BENCH_MIB);
+        bench_run(bench_lens[l], false, true, (size_t)total_mib * BENCH_MIB);
+        bench_run(bench_lens[l], true, false, (size_t)total_mib * BENCH_MIB);
+        bench_run(bench_lens[l], true, true, (size_t)total_mib * BENCH_MIB);
+    }
+
+    return 0;
+}
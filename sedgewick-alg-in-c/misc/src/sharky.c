@@ -18,11 +18,22 @@
 #include <sys/uio.h>
 
 #include "sharkybuf.h"
+#include "sharkyring.h"
+#include "sharkyuring.h"
 
 #define MAX_NAME_LEN 50
 #define MAX_ED_LIMIT 10
 #define SKIPLIST_MAX_LEVELS 30
 #define SKIPLIST_UNROLLED_DATAITEMS 5
+#define SHARKY_POOL_SLAB_LEN (2 * 1024 * 1024)
+#define SHARKY_PIPE_LEN (1024 * 1024)
+#define SHARKY_BUF_LEN (64 * 1024)
+#define SHARKY_URING_BUFS 8
+#define SHARKY_SHM_SLOTS 16
+#define SHARKY_DIRECT_BUF_LEN (1024 * 1024)
+
+#define SHARKY_TRANSPORT_PIPE 0
+#define SHARKY_TRANSPORT_SHM 1
 
 #define DEBUG_MSG(format, ...) fprintf(stderr, format, __VA_ARGS__)
 
@@ -33,7 +44,28 @@
  ***************************************************************
  */
 
-// Usage: $0 <max hamming distance> <name> [dictionary file]
+// Usage: $0 [options] <max hamming distance> <name> [dictionary file]
+
+
+struct sharky_opts {
+    /* generator */
+    int                     max_ed;
+    char                   *name;
+
+    /* consumer - if dictpath is NULL, candidates are just written to stdout */
+    char                   *dictpath;
+    char                   *outpath;                // NULL for stdout
+    char                   *teepath;                // also archive candidates here, if not NULL
+    bool                    direct;                 // write outpath with O_DIRECT
+    bool                    splice;                 // pass frames through with splice(2)
+    bool                    uring;                  // copy with io_uring rather than read/write
+
+    /* transport between generator and consumer */
+    int                     transport;              // SHARKY_TRANSPORT_*
+    size_t                  buf_len;                // size of each buffer sent
+    int                     batch_ct;               // buffers given away per vmsplice
+    bool                    framed;                 // buffers carry a struct sb_frame_hdr
+};
 
 
 struct skiplist_node {
@@ -46,33 +78,39 @@ struct skiplist_node {
 };
 
 struct sdict {
-    /* dictonary text */
-    int                     dict_fd;
-    char                   *dict_addr;
-    size_t                  dict_len;
+    /* dictonary text, mapped read-only */
+    struct sharkybuf        dict;
     /* dictionary index */
-    struct sharkybuf        sl_sbuflist_sbuf;       // Memory where sl_sbuflist is stored
-    int                     sl_sbuflist_entry_ct;   // Number of sbufs in sl_sbuflist
-    struct sharkybuf       *sl_sbuflist;            // List of sbufs, each representing memory
-                                                    //     for storing skiplist nodes in
+    struct sb_arena         sl_arena;               // Memory for storing skiplist nodes in
     struct skiplist_node   *sl_headnode;            // Pointer to head skiplist node
     struct skiplist_node   *sl_sentinel;            // Pointer to skiplist sentinel node
 };
 
-void hamming(int max_ed, char *name, int fd) {
+void hamming(const struct sharky_opts *opts, int fd, struct sharkyring *ring) {
     /*
-     * Generate all possible permutations of the string name where up to
-     * max_ed columns have been overwritten with a character from a-z,
-     * and then write them to pipe fd in buffer-sized chunks, separated
-     * by newlines.
+     * Generate all possible permutations of the string opts->name where up
+     * to opts->max_ed columns have been overwritten with a character from
+     * a-z, and then write them to pipe fd in buffer-sized chunks, separated
+     * by newlines. Buffers are opts->buf_len bytes, and are given away to
+     * the pipe opts->batch_ct at a time. If ring is not NULL, candidates are
+     * written straight into its slots instead, and fd isn't used.
+     *
+     * Unframed buffers are padded out with null bytes, which come for free
+     * as every buffer starts out zeroed and records are only ever appended
+     * whole; framed buffers needn't be, their header gives the length.
      *
      * Asserts:
      *      strlen(name) <= (MAX_NAME_LEN - 1)
      *      max_ed <= MAX_ED_LIMIT
+     *      0 < batch_ct <= SHARKYBUF_MAX_IOV
      */
-    struct sharkybuf    sbuf;
-    size_t              buf_len;
-    size_t              page_size;
+    int                 max_ed = opts->max_ed;
+    char               *name = opts->name;
+    int                 batch_ct = opts->batch_ct;
+    struct sharkybuf    sbufs[SHARKYBUF_MAX_IOV];
+    int                 sbuf_cur;
+    struct sb_pool      pool;
+    struct sharkybuf   *sb;                     // buffer being filled
 
     int                 name_len;
     char                name_temp[MAX_NAME_LEN];
@@ -83,16 +121,34 @@ void hamming(int max_ed, char *name, int fd) {
     // Pre-flight checks
     assert(strlen(name) <= (MAX_NAME_LEN - 1));
     assert(max_ed <= MAX_ED_LIMIT);
+    assert(batch_ct > 0 && batch_ct <= SHARKYBUF_MAX_IOV);
 
     name_len = strlen(name);
 
     fprintf(stderr, "Max hamming distance: %d, Name: \"%s\" (Length: %d)\n", max_ed, name, name_len);
 
-    // Allocate a buffer, page-aligned, one page in size
-    page_size = (size_t)sysconf(_SC_PAGESIZE);
-    buf_len = page_size;
+    if (ring != NULL) {
+        // Fill ring slots in place - nothing to allocate or give away
+        sb = sr_produce_begin(ring);
+
+        if (opts->framed)
+            sb_frame_init(sb);
+    } else {
+        // Allocate a batch of page-aligned buffers from a pool of pre-faulted
+        // pages so that replacing each page we give away to the pipe doesn't
+        // cost an munmap, an mmap and a page fault
+        sb_pool_init(&pool, SHARKY_POOL_SLAB_LEN);
+
+        for (sbuf_cur = 0; sbuf_cur < batch_ct; sbuf_cur++) {
+            sb_create_pool(&sbufs[sbuf_cur], &pool, opts->buf_len);
 
-    sb_create_mmap(&sbuf, buf_len);
+            if (opts->framed)
+                sb_frame_init(&sbufs[sbuf_cur]);
+        }
+
+        sbuf_cur = 0;
+        sb = &sbufs[sbuf_cur];
+    }
 
     // Hamming distance
     for (ed = 1; ed <= max_ed; ed++) {
@@ -149,23 +205,37 @@ void hamming(int max_ed, char *name, int fd) {
                     // No, emit candidate
                     for ( ; ; ) {
                         // Append candidate word + newline to buffer
-                        int append_rv = sb_append_line_or_zeroes(&sbuf, name_temp);
+                        size_t append_rv = sb_append_record(sb, name_temp, (size_t)name_len, '\n');
 
-                        // If truncation has occurred, i.e. only part of the candidate word
-                        // was able to be written to the buffer and was subsequently
-                        // zeroed, then:
+                        // If the candidate word didn't fit in what's left of the buffer, then:
                         //
-                        // 1. Write the buffer out to fd, retrying until the entire buffer
-                        //    has been written out
-                        // 2. Clear (zero) the buffer
-                        // 3. Reset pointers and counters
-                        // 4. Go around the loop again in order to retry appending the
+                        // 1. Move on to the next buffer in the batch
+                        // 2. If that was the last buffer, write the whole batch out to fd,
+                        //    retrying until every buffer has been written out, and start
+                        //    again with the fresh buffers that replace them
+                        //    (or, for a ring, publish the slot and wait for a free one)
+                        // 3. Go around the loop again in order to retry appending the
                         //    candidate word to the buffer
 
                         if (append_rv != 0) {
-                            // Give away page(s) to pipe using vmsplice, and receive details of
-                            // new page into struct at &sbuf.
-                            sb_sendbuf_vmsplice(&sbuf, fd);
+                            if (ring != NULL) {
+                                if (opts->framed)
+                                    sb_frame_seal(sb);
+
+                                sr_produce_commit(ring);
+                                sb = sr_produce_begin(ring);
+
+                                if (opts->framed)
+                                    sb_frame_init(sb);
+                            } else if (++sbuf_cur == batch_ct) {
+                                // Give away page(s) to pipe using vmsplice, and receive details of
+                                // new pages into structs in sbufs.
+                                sb_sendbufs_vmsplice(sbufs, batch_ct, fd);
+                                sbuf_cur = 0;
+                            }
+
+                            if (ring == NULL)
+                                sb = &sbufs[sbuf_cur];
 
                             // Retry writing candidate word
                             continue;
@@ -201,102 +271,149 @@ void hamming(int max_ed, char *name, int fd) {
 
     } // for ed
 
-    // Write partially-full page to pipe before freeing it
-    if (sbuf.dirty) {
+    if (ring != NULL) {
+        // Publish partially-full slot, then tell the consumer we're done
+        if (sb->dirty) {
+            if (opts->framed)
+                sb_frame_seal(sb);
+
+            sr_produce_commit(ring);
+        }
+
+        sr_produce_close(ring);
+        return;
+    }
+
+    // Write full buffers and partially-full buffer to pipe before freeing them
+    if (sbufs[sbuf_cur].dirty)
+        sbuf_cur++;
+
+    if (sbuf_cur > 0) {
         // Give away page(s) to pipe using vmsplice, and receive details of
-        // new page into struct at &sbuf.
-        sb_sendbuf_vmsplice(&sbuf, fd);
+        // new pages into structs in sbufs.
+        sb_sendbufs_vmsplice(sbufs, sbuf_cur, fd);
     }
 
     // Clean up
-    sb_dispose(&sbuf);
+    for (sbuf_cur = 0; sbuf_cur < batch_ct; sbuf_cur++)
+        sb_dispose(&sbufs[sbuf_cur]);
+
+    sb_pool_destroy(&pool);
+
+}
+
+void catlines_emit(const struct sharky_opts *opts, struct sb_direct_sink *sink, struct sharkybuf *sb) {
+    /*
+     * Write the candidates in received buffer sb to standard output, or to
+     * sink if it isn't NULL: the frame payload if opts->framed, otherwise
+     * the buffer without its trailing null bytes
+     */
+    char               *payload_ptr;
+    size_t              payload_len;
+
+    if (sink == NULL) {
+        if (opts->framed)
+            sb_frame_payload_to_fd(sb, fileno(stdout));
+        else
+            sb_buf_to_stdout(sb);
+    } else {
+        if (opts->framed)
+            sb_frame_payload(sb, &payload_ptr, &payload_len);
+        else {
+            payload_ptr = sb->addr;
+            payload_len = sb_content_len(sb);
+        }
 
+        sb_direct_write(sink, payload_ptr, payload_len);
+    }
 }
 
-void catlines(int fd) {
+void catlines(const struct sharky_opts *opts, int fd, struct sharkyring *ring) {
     /*
      * Read buffer-sized chunks from pipe fd and write back out to standard
-     * output, truncating any null bytes from the end of the received buffer.
+     * output, truncating any null bytes from the end of the received buffer,
+     * or - if framed - writing just the payload given by the frame header.
+     * With opts->splice, frames are spliced through without being read; with
+     * opts->uring, buffers are copied through io_uring. If ring is not NULL,
+     * buffers are taken straight from its slots instead of from fd. With
+     * opts->direct, output goes to opts->outpath through an O_DIRECT sink.
      */
-    struct sharkybuf    sbuf;
-    size_t              buf_len;
-    size_t              page_size;
+    struct sharkybuf        sbuf;
+    struct sharkybuf       *slot;
+    struct sb_direct_sink   direct_sink;
+    struct sb_direct_sink  *sink = NULL;
+
+    if (opts->direct) {
+        sb_direct_open(&direct_sink, opts->outpath, SHARKY_DIRECT_BUF_LEN);
+        sink = &direct_sink;
+    }
 
-    // Allocate a buffer, page-aligned, one page in size
-    page_size = (size_t)sysconf(_SC_PAGESIZE);
-    buf_len = page_size;
-    sb_create_posix_memalign(&sbuf, buf_len);
+    // Write out ring slots in place, there's nothing to read
+    if (ring != NULL) {
+        while (sr_consume_begin(ring, &slot, true) == SHARKYRING_OK) {
+            catlines_emit(opts, sink, slot);
+            sr_consume_commit(ring);
+        }
+
+        if (sink) sb_direct_close(sink);
+        return;
+    }
+
+    // Zero-copy pass-through, nothing needs to look at the candidates
+    if (opts->splice) {
+        sb_splice_frames_to_fd(fd, fileno(stdout), opts->buf_len);
+        return;
+    }
+
+    // Batched copy with several buffers in flight, if the kernel lets us
+    if (opts->uring) {
+        if (su_copy_bufs(fd, fileno(stdout), opts->buf_len, SHARKY_URING_BUFS, opts->framed) == 0)
+            return;
+
+        fprintf(stderr, "io_uring unavailable, falling back to read/write.\n");
+    }
+
+    // Allocate a buffer, page-aligned, the same size as the producer's
+    sb_create_posix_memalign(&sbuf, opts->buf_len);
 
     while (true) {
         int read_rv = sb_recvbuf_read(&sbuf, fd);
 
-        // Write content of buffer to stdout
-        sb_buf_to_stdout(&sbuf);
+        if (opts->framed) {
+            // Write payload, and reset writer head without zeroing
+            if (sbuf.dirty)
+                catlines_emit(opts, sink, &sbuf);
 
-        // Wipe buffer and reset writer head
-        sb_wipe(&sbuf);
+            sb_rewind(&sbuf);
+        } else {
+            // Write content of buffer
+            catlines_emit(opts, sink, &sbuf);
+
+            // Wipe buffer and reset writer head
+            sb_wipe(&sbuf);
+        }
 
         // Did we reach EOF?
         if (read_rv == 1) break;
     }
 
     // Clean up
+    if (sink) sb_direct_close(sink);
     sb_dispose(&sbuf);
 }
 
-void sdict_sl_realloc(struct sdict *sd) {
-    size_t          new_len;
-
-    // Calculate new size
-    new_len = sd->sl_sbuflist_sbuf.len * 2;
-
-    // Request realloc
-    sb_realloc(&(sd->sl_sbuflist_sbuf), new_len);
-
-    // Update address of sd->sl_sbuflist
-    sd->sl_sbuflist = sd->sl_sbuflist_sbuf.addr;
-}
-
 struct skiplist_node* sdict_sl_allocnode(struct sdict *sd, int linkptr_ct, int dataptr_ct) {
-    size_t                  page_size;
     struct skiplist_node   *node_addr;
     size_t                  node_size;
 
-    page_size = (size_t)sysconf(_SC_PAGESIZE);
-
     // Calculate size required
     node_size = sizeof(struct skiplist_node) + ((linkptr_ct + dataptr_ct) * sizeof(void*));
 
-    // Check available space
-    if (((sd->sl_sbuflist)[(sd->sl_sbuflist_entry_ct - 1)]).writer_len_remaining < node_size) {
-        // Need another buffer...
-        //
-        // First, check if memory allocation for list of buffers needs enlarging...
-        if (sd->sl_sbuflist_sbuf.writer_len_remaining < sizeof(struct sharkybuf)) {
-            sdict_sl_realloc(sd);
-        }
-
-        // Assert that there is enough room now for another sharkybuf struct
-        assert(sd->sl_sbuflist_sbuf.writer_len_remaining >= sizeof(struct sharkybuf));
-
-        // Create new buffer
-        page_size = (size_t)sysconf(_SC_PAGESIZE);
-        sb_create_malloc(&((sd->sl_sbuflist)[sd->sl_sbuflist_entry_ct]), page_size);
-        (sd->sl_sbuflist_entry_ct)++;
-    }
-
-    // Assert that there is enough room now for the new node
-    assert(((sd->sl_sbuflist)[(sd->sl_sbuflist_entry_ct - 1)]).writer_len_remaining >= node_size);
-
     // Initialize skiplist node
-    node_addr = (struct skiplist_node*)(((sd->sl_sbuflist)[(sd->sl_sbuflist_entry_ct - 1)]).writer_ptr);
+    node_addr = sb_arena_alloc(&(sd->sl_arena), node_size, sizeof(void*));
     node_addr->linkptr_ct = linkptr_ct;
     node_addr->dataptr_ct = dataptr_ct;
 
-    // Bump writer pointer
-    ((sd->sl_sbuflist)[(sd->sl_sbuflist_entry_ct - 1)]).writer_ptr += (node_size / sizeof(char));
-    ((sd->sl_sbuflist)[(sd->sl_sbuflist_entry_ct - 1)]).writer_len_remaining -= node_size;
-
     return node_addr;
 }
 
@@ -313,30 +430,10 @@ void sdict_sl_init(struct sdict *sd) {
     // Pre-flight checks
     assert(sd != NULL);
 
-    // Allocate buffer to store skiplist buffer list in
-    //
-    // N.B. This buffer can be moved safely (e.g. when resized with
-    // realloc), as there is only ever one pointer to it, and it is
-    // only used to keep track of freeing buffers from the pool used
-    // for the skiplist index.
-
+    // Set up arena to store skiplist index in, starting small - it
+    // grows geometrically as the dictionary is indexed
     page_size = (size_t)sysconf(_SC_PAGESIZE);
-    sb_create_malloc(&(sd->sl_sbuflist_sbuf), page_size);
-
-    DEBUG_MSG("-DD- Allocated sl_sbuflist_sbuf, .addr=%p, .len=%d.\n", sd->sl_sbuflist_sbuf.addr, sd->sl_sbuflist_sbuf.len);
-
-    sd->sl_sbuflist = (struct sharkybuf*)(sd->sl_sbuflist_sbuf.addr);
-    sd->sl_sbuflist_entry_ct = 0;
-
-    // Allocate buffer to store skiplist index in
-    sb_create_malloc(&((sd->sl_sbuflist)[sd->sl_sbuflist_entry_ct]), page_size);
-    (sd->sl_sbuflist_entry_ct)++;
-
-    DEBUG_MSG("-DD- Allocated sl_sbuflist[%d], .addr=%p, .len=%d. sl_sbuflist_entry_ct is now %d.\n", (sd->sl_sbuflist_entry_ct - 1), (sd->sl_sbuflist)[(sd->sl_sbuflist_entry_ct - 1)].addr, (sd->sl_sbuflist)[(sd->sl_sbuflist_entry_ct - 1)].len, sd->sl_sbuflist_entry_ct);
-
-    // Bump sd->sl_sbuflist_sbuf writer pointer
-    sd->sl_sbuflist_sbuf.writer_ptr += (sizeof(struct sharkybuf) / sizeof(char));
-    sd->sl_sbuflist_sbuf.writer_len_remaining -= sizeof(struct sharkybuf);
+    sb_arena_init(&(sd->sl_arena), page_size, SB_ARENA_BACKING_MMAP);
 
     // Initialize skiplist headnode
     sd->sl_headnode = sdict_sl_allocnode(sd, SKIPLIST_MAX_LEVELS, 0);
@@ -366,70 +463,34 @@ void sdict_sl_destruct(struct sdict *sd) {
     // Pre-flight checks
     assert(sd != NULL);
 
-    // Dispose of all sbufs in the pool
-    while(sd->sl_sbuflist_entry_ct > 0) {
-        sb_dispose(&((sd->sl_sbuflist)[(sd->sl_sbuflist_entry_ct - 1)]));
-        (sd->sl_sbuflist_entry_ct)--;
-    }
-
-    // Dispose of sbuf used to store pool sbuf structs
-    sb_dispose(&(sd->sl_sbuflist_sbuf));
+    // Free every skiplist node at once
+    sb_arena_destroy(&(sd->sl_arena));
 
     // Clear skiplist struct entries
     sd->sl_sentinel = NULL;
     sd->sl_headnode = NULL;
-    sd->sl_sbuflist = NULL;
 }
 
 void sdict_open(struct sdict *sd, char *dictpath) {
     /*
-     * Open dictionary at dictpath, mmap it, process it into a skiplist
-     * data structure and store necessary information to access it in *sb.
+     * Open dictionary at dictpath, map it, process it into a skiplist
+     * data structure and store necessary information to access it in *sd.
      *
      * Asserts:
      *          sd is not NULL
      *          dictpath is not NULL
      */
-    char               *dict_addr;
-    int                 dict_fd;
-    int                 fst_rv;
-    struct stat         dict_statbuf;
-    size_t              dict_len;
+    struct sb_fault_cost    cost;
 
     // Pre-flight checks
     assert(sd != NULL);
     assert(dictpath != NULL);
 
-    // Open
-    dict_fd = open(dictpath, O_RDONLY);
-
-    if (dict_fd == -1) {
-        perror("[sdict_open] open");
-        exit(4);
-    }
-
-    // Get size
-    fst_rv = fstat(dict_fd, &dict_statbuf);
-
-    if (fst_rv == -1) {
-        perror("[sdict_open] fstat");
-        exit(4);
-    }
-
-    dict_len = dict_statbuf.st_size;
+    // Map - pre-faulted, so building the index doesn't stall on the disk
+    sb_create_filemap(&(sd->dict), dictpath, &cost);
 
-    // Mmap
-    dict_addr = mmap(NULL, dict_len, PROT_READ, MAP_PRIVATE, dict_fd, 0);
-
-    if (dict_addr == MAP_FAILED) {
-        perror("[sdict_open] mmap");
-        exit(4);
-    }
-
-    // Populate struct
-    sd->dict_addr = dict_addr;
-    sd->dict_fd = dict_fd;
-    sd->dict_len = dict_len;
+    DEBUG_MSG("-DD- Mapped %zu byte dictionary: %ld minor, %ld major page faults, %llu us.\n",
+              sd->dict.len, cost.minflt, cost.majflt, cost.ns / 1000);
 
     // Initialize skiplist
     sdict_sl_init(sd);
@@ -439,110 +500,347 @@ void sdict_open(struct sdict *sd, char *dictpath) {
 }
 
 void sdict_close(struct sdict *sd) {
-    int         munmap_rv;
-    int         close_rv;
-
     // Free buffers used by skiplist and by buffer pool
     sdict_sl_destruct(sd);
 
-    // Munmap
-    munmap_rv = munmap(sd->dict_addr, sd->dict_len);
+    // Unmap dictionary, clearing its struct
+    sb_dispose(&(sd->dict));
+}
 
-    if (munmap_rv == -1) {
-        perror("[sdict_close] munmap");
-        exit(4);
-    }
+void sdict_check_word(struct sdict *sd, const char *candw, size_t candw_len) {
+    /*
+     * Emit candidate word candw, of length candw_len, to standard output
+     * if it appears in the dictionary
+     */
 
-    // Close file
-    close_rv = close(sd->dict_fd);
+    //XXXX;
+}
 
-    if (close_rv == -1) {
-        perror("[sdict_close] close");
-        exit(4);
-    }
+void sdict_check(struct sdict *sd, struct sb_line_iter *it, const char *candw_ptr, size_t candw_len) {
+    /*
+     * Check the newline-separated candidate words in the candw_len bytes at
+     * candw_ptr, which carry on from the last chunk given to iterator it
+     */
+    const char     *candw;
+    size_t          len;
 
-    // Clear struct
-    sd->dict_fd = 0;
-    sd->dict_addr = NULL;
-    sd->dict_len = 0;
+    sb_line_iter_feed(it, candw_ptr, candw_len);
+
+    while (sb_line_iter_next(it, &candw, &len))
+        sdict_check_word(sd, candw, len);
 }
 
-void checkwords(int fd, char *dictpath) {
+void checkwords(const struct sharky_opts *opts, int fd, struct sharkyring *ring) {
     /*
      * Read buffer-sized chunks from pipe fd containing zero or more newline-separated
-     * candidate words followed by null bytes up to the end of the buffer, and write
-     * those that appear in dictionary file dictpath to standard output.
+     * candidate words followed by null bytes up to the end of the buffer (or, if
+     * framed, a frame header giving the length of the candidate words), and write
+     * those that appear in dictionary file opts->dictpath to standard output.
+     * If ring is not NULL, chunks are taken straight from its slots instead.
      */
     struct sharkybuf    candw_sbuf;
-    size_t              candw_buf_len;
+    struct sharkybuf   *candw_sb;
     struct sdict        sd;
-    size_t              page_size;
+    struct sb_line_iter it;
     int                 read_rv;
-
-    // Get system page size
-    page_size = (size_t)sysconf(_SC_PAGESIZE);
+    char               *candw_ptr;
+    size_t              candw_len;
+    const char         *candw;
 
     // Read in dictionary
-    sdict_open(&sd, dictpath);
+    sdict_open(&sd, opts->dictpath);
+
+    // Split chunks into candidate words
+    sb_line_iter_init(&it);
+
+    if (ring != NULL) {
+        // Check candidate words in ring slots in place
+        while (sr_consume_begin(ring, &candw_sb, true) == SHARKYRING_OK) {
+            if (opts->framed) {
+                sb_frame_payload(candw_sb, &candw_ptr, &candw_len);
+            } else {
+                candw_ptr = candw_sb->addr;
+                candw_len = sb_content_len(candw_sb);
+            }
 
-    // Allocate buffer to receive candidate words
-    candw_buf_len = page_size;
-    sb_create_posix_memalign(&candw_sbuf, candw_buf_len);
+            sdict_check(&sd, &it, candw_ptr, candw_len);
+            sr_consume_commit(ring);
+        }
+    } else {
+        // Allocate buffer to receive candidate words, the same size as the producer's
+        sb_create_posix_memalign(&candw_sbuf, opts->buf_len);
+
+        // Read buffer-size chunks of candidate words from fd, and check against dictionary
+        while (true) {
+            read_rv = sb_recvbuf_read(&candw_sbuf, fd);
+
+            // Find candidate words
+            if (opts->framed && candw_sbuf.dirty) {
+                sb_frame_payload(&candw_sbuf, &candw_ptr, &candw_len);
+            } else {
+                candw_ptr = candw_sbuf.addr;
+                candw_len = candw_sbuf.len - candw_sbuf.writer_len_remaining;
+            }
 
-    // Read buffer-size chunks of candidate words from fd, and check against dictionary
-    while (true) {
-        read_rv = sb_recvbuf_read(&candw_sbuf, fd);
+            // Check words and emit those that appear in the dictionary to standard output
+            sdict_check(&sd, &it, candw_ptr, candw_len);
 
-        // Check words and emit those that appear in the dictionary to standard output
-        //XXXX;
+            // Wipe buffer (unless framed) and reset writer head
+            if (opts->framed)
+                sb_rewind(&candw_sbuf);
+            else
+                sb_wipe(&candw_sbuf);
 
-        // Wipe buffer and reset writer head
-        sb_wipe(&candw_sbuf);
+            // Did we reach EOF?
+            if (read_rv == 1) break;
+        }
 
-        // Did we reach EOF?
-        if (read_rv == 1) break;
+        sb_dispose(&candw_sbuf);
     }
 
+    // Check any last word without a newline
+    if (sb_line_iter_finish(&it, &candw, &candw_len))
+        sdict_check_word(&sd, candw, candw_len);
+
+    sb_line_iter_dispose(&it);
+
     // Close dictionary
     sdict_close(&sd);
+}
 
-    // Clean up
-    sb_dispose(&candw_sbuf);
+void fanout(struct sharky_opts *opts, int fd[2], pid_t childpids[2]) {
+    /*
+     * Insert a tee(2) fan-out between the generator and the consumer: one
+     * child duplicates the generator's pipe into a pipe for the consumer
+     * and a pipe for an archive child, which writes candidates to
+     * opts->teepath. Each branch has its own pipe, so each gets its own
+     * backpressure.
+     *
+     * On return, fd[0] is the consumer's end of its branch, and
+     * childpids[] holds the fan-out and archive children.
+     */
+    int                 check_fd[2], tee_fd[2];
+    struct sharky_opts  archive_opts;
+
+    if (pipe(check_fd) == -1 || pipe(tee_fd) == -1) {
+        perror("pipe");
+        exit(4);
+    }
+
+    // Branches hold as much as the generator's pipe
+    sb_pipe_set_size(check_fd[1], SHARKY_PIPE_LEN);
+    sb_pipe_set_size(tee_fd[1], SHARKY_PIPE_LEN);
+
+    if ((childpids[0] = fork()) == -1) {
+        perror("fork");
+        exit(4);
+    }
+
+    if (0 == childpids[0]) {
+        // Fan-out child keeps only the pipe ends it copies between
+        close(fd[1]);
+        close(check_fd[0]);
+        close(tee_fd[0]);
+        sb_stats_install("fanout");
+
+        sb_tee_fanout(fd[0], tee_fd[1], check_fd[1]);
+
+        close(fd[0]);
+        close(check_fd[1]);
+        close(tee_fd[1]);
+        exit(0);
+    }
+
+    if ((childpids[1] = fork()) == -1) {
+        perror("fork");
+        exit(4);
+    }
+
+    if (0 == childpids[1]) {
+        // Archive child keeps only its branch, and writes it to teepath
+        int out_fd = open(opts->teepath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+        if (out_fd == -1 || dup2(out_fd, STDOUT_FILENO) == -1) {
+            perror(opts->teepath);
+            exit(4);
+        }
+
+        close(out_fd);
+        close(fd[0]);
+        close(fd[1]);
+        close(check_fd[0]);
+        close(check_fd[1]);
+        close(tee_fd[1]);
+        sb_stats_install("archive");
+
+        archive_opts = *opts;
+        archive_opts.dictpath = NULL;
+        archive_opts.direct = false;
+        catlines(&archive_opts, tee_fd[0], NULL);
+
+        close(tee_fd[0]);
+        exit(0);
+    }
+
+    // Parent hands the consumer's branch on in place of the generator's pipe
+    close(fd[0]);
+    close(check_fd[1]);
+    close(tee_fd[0]);
+    close(tee_fd[1]);
+    fd[0] = check_fd[0];
 }
 
 void usage(char *progname) {
-    fprintf(stderr, "Usage: %s <max hamming distance> <name> [dictionary file]\n", progname);
+    fprintf(stderr, "Usage: %s [options] <max hamming distance> <name> [dictionary file]\n", progname);
+    fprintf(stderr, "  -f, --framed     send length-prefixed frames instead of null-padded buffers\n");
+    fprintf(stderr, "  -s, --splice     splice candidates straight to output (implies --framed,\n");
+    fprintf(stderr, "                   no dictionary)\n");
+    fprintf(stderr, "  -u, --uring      copy candidates to output using io_uring (no dictionary)\n");
+    fprintf(stderr, "  --output=FILE    write to FILE instead of standard output\n");
+    fprintf(stderr, "  --direct         write --output FILE with O_DIRECT, bypassing the page cache\n");
+    fprintf(stderr, "                   (no dictionary, --splice or --uring)\n");
+    fprintf(stderr, "  --tee=FILE       also write candidates to FILE, fanning out with tee(2)\n");
+    fprintf(stderr, "                   (--transport=pipe only)\n");
+    fprintf(stderr, "  --mem-limit=MIB  soft limit on buffer memory per process, in MiB\n");
+    fprintf(stderr, "  --transport=pipe|shm\n");
+    fprintf(stderr, "                   pass candidates over a pipe (default), or a ring in shared memory\n");
 }
 
 int main(int argc, char *argv[]) {
-    int     fd[2], max_ed;
-    char   *dictpath;
-    char   *name;
-    pid_t   childpid_dictcheck;
-    int     status_dictcheck;
-
-    // Check and extract command-line arguments
-    switch (argc) {
-        case 4:
-            dictpath = argv[3];
+    struct sharky_opts  opts;
+    int                 fd[2] = { -1, -1 };
+    struct sharkyring   ring;
+    struct sharkyring  *ringp = NULL;
+    int                 ai;
+    pid_t               childpid_dictcheck;
+    int                 status_dictcheck;
+    pid_t               childpids_fanout[2];
+    int                 status_fanout;
+    size_t              pipe_len;
+    size_t              mem_limit_mib = 0;
+
+    memset(&opts, 0, sizeof(opts));
+
+    // Check and extract command-line options...
+    for (ai = 1; ai < argc && argv[ai][0] == '-'; ai++) {
+        if (!strcmp(argv[ai], "-f") ||
+            !strcmp(argv[ai], "--framed"))
+            opts.framed = true;
+        else if (!strcmp(argv[ai], "-s") ||
+                 !strcmp(argv[ai], "--splice"))
+            opts.splice = opts.framed = true;
+        else if (!strcmp(argv[ai], "-u") ||
+                 !strcmp(argv[ai], "--uring"))
+            opts.uring = true;
+        else if (!strncmp(argv[ai], "--output=", 9))
+            opts.outpath = argv[ai] + 9;
+        else if (!strcmp(argv[ai], "--direct"))
+            opts.direct = true;
+        else if (!strncmp(argv[ai], "--tee=", 6))
+            opts.teepath = argv[ai] + 6;
+        else if (!strncmp(argv[ai], "--mem-limit=", 12))
+            sscanf(argv[ai] + 12, "%zu", &mem_limit_mib);
+        else if (!strcmp(argv[ai], "--transport=pipe"))
+            opts.transport = SHARKY_TRANSPORT_PIPE;
+        else if (!strcmp(argv[ai], "--transport=shm"))
+            opts.transport = SHARKY_TRANSPORT_SHM;
+        else {
+            fprintf(stderr, "%s: Unexpected option: %s. Exiting.\n\n", argv[0], argv[ai]);
+            usage(argv[0]);
+            return 3;
+        }
+    }
+
+    // ...and arguments
+    switch (argc - ai) {
         case 3:
-            sscanf(argv[1], "%d", &max_ed);
-            name = argv[2];
+            opts.dictpath = argv[ai + 2];
+        case 2:
+            sscanf(argv[ai], "%d", &opts.max_ed);
+            opts.name = argv[ai + 1];
             break;
         default:
-            fprintf(stderr, "%s: Unexpected number of arguments: %d. Exiting.\n\n", argv[0], argc - 1);
+            fprintf(stderr, "%s: Unexpected number of arguments: %d. Exiting.\n\n", argv[0], argc - ai);
             usage(argv[0]);
             return 3;
     }
 
+    if ((opts.splice || opts.uring) && opts.dictpath) {
+        fprintf(stderr, "%s: --splice and --uring can't be used with a dictionary. Exiting.\n\n", argv[0]);
+        usage(argv[0]);
+        return 3;
+    }
 
-    // Create pipe
+    if ((opts.splice || opts.uring) && opts.transport != SHARKY_TRANSPORT_PIPE) {
+        fprintf(stderr, "%s: --splice and --uring need --transport=pipe. Exiting.\n\n", argv[0]);
+        usage(argv[0]);
+        return 3;
+    }
+
+    if (opts.direct && (!opts.outpath || opts.dictpath || opts.splice || opts.uring)) {
+        fprintf(stderr, "%s: --direct needs --output, and no dictionary, --splice or --uring. Exiting.\n\n",
+                argv[0]);
+        usage(argv[0]);
+        return 3;
+    }
+
+    if (opts.teepath && opts.transport != SHARKY_TRANSPORT_PIPE) {
+        fprintf(stderr, "%s: --tee needs --transport=pipe. Exiting.\n\n", argv[0]);
+        usage(argv[0]);
+        return 3;
+    }
+
+    // Redirect standard output, unless the consumer opens its own sink
     //
-    if ((pipe(fd)) == -1) {
-        perror("pipe");
-        exit(4);
+    if (opts.outpath && !opts.direct) {
+        int out_fd = open(opts.outpath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+        if (out_fd == -1 || dup2(out_fd, STDOUT_FILENO) == -1) {
+            perror(opts.outpath);
+            exit(4);
+        }
+
+        close(out_fd);
     }
 
+    if (opts.transport == SHARKY_TRANSPORT_SHM) {
+        // Create ring of buffer-sized slots in memory that stays shared
+        // with the child after fork(2)
+        //
+        opts.buf_len = SHARKY_BUF_LEN;
+        opts.batch_ct = 1;
+
+        sr_create_shared(&ring, SHARKY_SHM_SLOTS, opts.buf_len);
+        ringp = &ring;
+    } else {
+        // Create pipe
+        //
+        if ((pipe(fd)) == -1) {
+            perror("pipe");
+            exit(4);
+        }
+
+        // Enlarge pipe, so that one vmsplice(2) can move a whole batch of
+        // multi-page buffers, and size the batch to match
+        pipe_len = sb_pipe_set_size(fd[1], SHARKY_PIPE_LEN);
+        opts.buf_len = (pipe_len < SHARKY_BUF_LEN) ? pipe_len : SHARKY_BUF_LEN;
+        opts.batch_ct = (int)(pipe_len / opts.buf_len);
+
+        if (opts.batch_ct > SHARKYBUF_MAX_IOV)
+            opts.batch_ct = SHARKYBUF_MAX_IOV;
+    }
+
+    // Hold buffer memory under the soft limit, shrinking pools and
+    // holding up allocations as we near it
+    sb_mem_set_limit(mem_limit_mib * 1024 * 1024);
+
+    // Dump I/O stats at exit, if built with them
+    sb_stats_install("producer");
+
+    // Fan candidates out to the archive, if asked
+    if (opts.teepath)
+        fanout(&opts, fd, childpids_fanout);
+
     // Fork
     //
     if ((childpid_dictcheck = fork()) == -1) {
@@ -551,33 +849,54 @@ int main(int argc, char *argv[]) {
     }
 
     if (0 == childpid_dictcheck) {
-        // Child closes input end of pipe
-        close(fd[1]);
+        // Child closes input end of pipe, and counts its own I/O
+        if (fd[1] != -1) close(fd[1]);
+        sb_stats_install("consumer");
+
+        // Don't wait forever on a ring whose producer has died
+        if (ringp) sr_watch_peer(ringp, getppid());
 
-        if (dictpath) {
-            checkwords(fd[0], dictpath);
+        if (opts.dictpath) {
+            checkwords(&opts, fd[0], ringp);
         } else {
-            catlines(fd[0]);
+            catlines(&opts, fd[0], ringp);
         }
 
         // Tidy up and exit
-        close(fd[0]);
+        if (fd[0] != -1) close(fd[0]);
+        if (ringp) sr_dispose(ringp);
         exit(0);
     } else {
         // Parent closes output end of pipe
-        close(fd[0]);
+        if (fd[0] != -1) close(fd[0]);
+
+        // Don't wait forever on a ring whose consumer has died - a pipe
+        // would give us SIGPIPE
+        if (ringp) sr_watch_peer(ringp, childpid_dictcheck);
 
-        hamming(max_ed, name, fd[1]);
+        hamming(&opts, fd[1], ringp);
 
         // Tidy up and wait for child to exit
-        close(fd[1]);
+        if (fd[1] != -1) close(fd[1]);
         waitpid(childpid_dictcheck, &status_dictcheck, 0);
 
+        if (ringp) sr_dispose(ringp);
+
         if (status_dictcheck != 0) {
             fprintf(stderr, "Child %d exited with status %d!\n", childpid_dictcheck, status_dictcheck);
             exit(5);
         }
 
+        // Wait for fan-out and archive children too
+        for (int i = 0; opts.teepath && i < 2; i++) {
+            waitpid(childpids_fanout[i], &status_fanout, 0);
+
+            if (status_fanout != 0) {
+                fprintf(stderr, "Child %d exited with status %d!\n", childpids_fanout[i], status_fanout);
+                exit(5);
+            }
+        }
+
         exit(0);
     }
 
@@ -4,13 +4,22 @@
 #include <assert.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
 #include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
 #include <sys/uio.h>
 // --
 //#include <sys/types.h>
@@ -18,6 +27,10 @@
 
 #include "sharkybuf.h"
 
+static void sb_pool_release_(struct sb_pool *pool, struct sb_pool_slab *slab, size_t len);
+static void sb_pool_want_refill_(struct sb_pool *pool);
+static void sb_pool_next_slab_(struct sb_pool *pool);
+
 /*
  ***************************************************************
  * sharkybuf.c  Buffer handling utility routines               *
@@ -26,6 +39,260 @@
  */
 
 
+#ifdef SHARKYBUF_STATS
+struct sb_stats sb_stats_global;
+#endif
+
+static inline unsigned long long sb_pages_(size_t len) {
+    // Number of system pages needed to hold len bytes, for the stats
+    size_t      page_len = (size_t)sysconf(_SC_PAGESIZE);
+
+    return (unsigned long long)((len + page_len - 1) / page_len);
+}
+
+#ifdef SHARKYBUF_STATS
+// Account, to buffer sb (or NULL) and the process, for one I/O syscall
+// started at SB_STAT_TIMER(t), which was asked to move want bytes, got
+// rv back, and counts bytes moved towards field dir
+#define SB_STAT_IO(sb, t, rv, want, dir) do {                                   \
+        SB_STAT_BLOCKED(sb, t);                                                 \
+        SB_STAT(sb, syscall_ct, 1);                                             \
+        if ((rv) > 0) {                                                         \
+            SB_STAT(sb, dir, (unsigned long long)(rv));                         \
+            if ((size_t)(rv) < (size_t)(want)) SB_STAT(sb, short_ct, 1);        \
+        } else if ((rv) < 0 && errno == EINTR) {                                \
+            SB_STAT(sb, eintr_ct, 1);                                           \
+        }                                                                       \
+    } while (0)
+#else
+#define SB_STAT_IO(sb, t, rv, want, dir) do { } while (0)
+#endif
+
+static size_t sb_dirty_extent_(struct sharkybuf *sb) {
+    /*
+     * Raise sb->dirty_len to the writer head, before the writer head goes
+     * back to the start of the buffer
+     *
+     * Returns:
+     *      number of bytes from the start of the buffer that may be non-zero
+     */
+    size_t      writer_off = (size_t)(sb->writer_ptr - (char*)(sb->addr));
+
+    if (writer_off > sb->dirty_len)
+        sb->dirty_len = writer_off;
+
+    return sb->dirty_len;
+}
+
+// Process-wide memory accounting, see sb_mem_set_limit(...). Counters are
+// updated atomically; the lock and cond are only for allocations waiting
+// on the soft limit, with gen bumped on every wakeup so that none is
+// missed while a waiter runs the shrinkers, and shrink_lock keeps
+// shrinkers registered while they run.
+static struct sb_mem_usage      sb_mem_;
+static unsigned                 sb_mem_waiters_;
+static unsigned long long       sb_mem_gen_;
+static pthread_mutex_t          sb_mem_lock_ = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t           sb_mem_cond_ = PTHREAD_COND_INITIALIZER;
+static pthread_mutex_t          sb_mem_shrink_lock_ = PTHREAD_MUTEX_INITIALIZER;
+static int                      sb_mem_shrinker_ct_;
+static struct {
+    size_t                    (*fn)(void *arg);
+    void                       *arg;
+} sb_mem_shrinkers_[SHARKYBUF_MEM_MAX_SHRINKERS];
+
+static bool sb_mem_over_(size_t len) {
+    unsigned long long  limit = __atomic_load_n(&(sb_mem_.limit), __ATOMIC_RELAXED);
+
+    return (limit > 0) && (__atomic_load_n(&(sb_mem_.live_total), __ATOMIC_SEQ_CST) + len > limit);
+}
+
+static void sb_mem_wake_(void) {
+    /*
+     * Tell allocations waiting on the soft limit that memory has been
+     * freed, or is ready for a shrinker to free
+     */
+    if (__atomic_load_n(&sb_mem_waiters_, __ATOMIC_SEQ_CST) > 0) {
+        pthread_mutex_lock(&sb_mem_lock_);
+        sb_mem_gen_++;
+        pthread_cond_broadcast(&sb_mem_cond_);
+        pthread_mutex_unlock(&sb_mem_lock_);
+    }
+}
+
+static void sb_mem_pending_add_(size_t len) {
+    /*
+     * Account for len bytes that are no longer in use, and that other
+     * threads will release without any help from an allocation waiting
+     * on the soft limit - e.g. a pool slab that has been moved off and is
+     * left for the buffers still in it to be disposed of
+     */
+    __atomic_add_fetch(&(sb_mem_.pending), len, __ATOMIC_SEQ_CST);
+}
+
+static void sb_mem_pending_sub_(size_t len) {
+    /*
+     * Account for len pending bytes having been released, after they have
+     * been uncharged, so that a waiter never sees them as neither
+     */
+    __atomic_sub_fetch(&(sb_mem_.pending), len, __ATOMIC_SEQ_CST);
+    sb_mem_wake_();
+}
+
+static void sb_mem_make_room_(size_t len) {
+    /*
+     * Try to get under the soft limit before allocating len more bytes:
+     * ask the shrinkers to give back what they can spare, and if that
+     * isn't enough, wait while there is memory pending release, running
+     * the shrinkers again each time we're woken. Waiting is bounded by
+     * SHARKYBUF_MEM_WAIT_MS, as a release may yet depend on this thread.
+     * With nothing pending there is nobody to wait for, so the allocation
+     * goes ahead over the limit straight away - the limit is soft.
+     */
+    struct timespec     deadline;
+    unsigned long long  start_ns = 0, shrunk, gen;
+    bool                waited = false;
+
+    pthread_mutex_lock(&sb_mem_lock_);
+    __atomic_add_fetch(&sb_mem_waiters_, 1, __ATOMIC_SEQ_CST);
+
+    while (true) {
+        gen = sb_mem_gen_;
+        pthread_mutex_unlock(&sb_mem_lock_);
+
+        // Shrinkers first, they don't need anyone else's help
+        shrunk = 0;
+        pthread_mutex_lock(&sb_mem_shrink_lock_);
+
+        for (int i = 0; i < sb_mem_shrinker_ct_ && sb_mem_over_(len); i++)
+            shrunk += sb_mem_shrinkers_[i].fn(sb_mem_shrinkers_[i].arg);
+
+        pthread_mutex_unlock(&sb_mem_shrink_lock_);
+        __atomic_add_fetch(&(sb_mem_.shrunk), shrunk, __ATOMIC_RELAXED);
+
+        pthread_mutex_lock(&sb_mem_lock_);
+
+        if (!sb_mem_over_(len)) break;
+
+        // Woken while shrinking? Then there may be more to shrink
+        if (sb_mem_gen_ != gen) continue;
+
+        if (__atomic_load_n(&(sb_mem_.pending), __ATOMIC_SEQ_CST) == 0) {
+            __atomic_add_fetch(&(sb_mem_.over_ct), 1, __ATOMIC_RELAXED);
+            break;
+        }
+
+        // Then backpressure - wait to be woken by sb_mem_wake_()
+        if (!waited) {
+            clock_gettime(CLOCK_MONOTONIC, &deadline);
+            start_ns = ((unsigned long long)deadline.tv_sec * 1000000000ULL) + (unsigned long long)deadline.tv_nsec;
+
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_nsec += (SHARKYBUF_MEM_WAIT_MS % 1000) * 1000000L;
+            deadline.tv_sec += SHARKYBUF_MEM_WAIT_MS / 1000 + deadline.tv_nsec / 1000000000L;
+            deadline.tv_nsec %= 1000000000L;
+            waited = true;
+        }
+
+        if (pthread_cond_timedwait(&sb_mem_cond_, &sb_mem_lock_, &deadline) == ETIMEDOUT) {
+            if (sb_mem_over_(len)) __atomic_add_fetch(&(sb_mem_.over_ct), 1, __ATOMIC_RELAXED);
+            break;
+        }
+    }
+
+    __atomic_sub_fetch(&sb_mem_waiters_, 1, __ATOMIC_SEQ_CST);
+    pthread_mutex_unlock(&sb_mem_lock_);
+
+    if (!waited) return;
+
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    __atomic_add_fetch(&(sb_mem_.wait_ct), 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&(sb_mem_.wait_ns),
+                       ((unsigned long long)deadline.tv_sec * 1000000000ULL) +
+                       (unsigned long long)deadline.tv_nsec - start_ns, __ATOMIC_RELAXED);
+}
+
+static void sb_mem_charge_(int strategy, size_t len) {
+    /*
+     * Account for len more bytes held by strategy, making room for them
+     * first if that would take us over the soft limit
+     */
+    unsigned long long  live, peak;
+
+    if (sb_mem_over_(len))
+        sb_mem_make_room_(len);
+
+    __atomic_add_fetch(&(sb_mem_.live[strategy]), len, __ATOMIC_RELAXED);
+    live = __atomic_add_fetch(&(sb_mem_.live_total), len, __ATOMIC_SEQ_CST);
+
+    peak = __atomic_load_n(&(sb_mem_.peak_total), __ATOMIC_RELAXED);
+    while (live > peak &&
+           !__atomic_compare_exchange_n(&(sb_mem_.peak_total), &peak, live, true,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+}
+
+static void sb_mem_uncharge_(int strategy, size_t len) {
+    /*
+     * Account for len fewer bytes held by strategy, and wake anyone
+     * waiting for memory to be freed
+     */
+    __atomic_sub_fetch(&(sb_mem_.live[strategy]), len, __ATOMIC_RELAXED);
+    __atomic_sub_fetch(&(sb_mem_.live_total), len, __ATOMIC_SEQ_CST);
+    sb_mem_wake_();
+}
+
+static inline void sb_cpu_relax_(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#endif
+}
+
+static void sb_wait_(struct sharkybuf *sb, int in_fd, int out_fd, int *tries) {
+    /*
+     * Back off after EAGAIN on non-blocking in_fd and/or out_fd (-1 if not
+     * involved), on behalf of buffer sb (NULL if none, for the stats).
+     * For the first few tries just spin briefly, as the other side is
+     * usually about to catch up; after that, sleep in poll(2) until
+     * in_fd is readable and out_fd is writable, so that backpressure costs
+     * no CPU and the other side gets the core.
+     */
+    struct pollfd   pfd;
+    int             fds[2] = { in_fd, out_fd };
+    short           events[2] = { POLLIN, POLLOUT };
+
+    SB_STAT_TIMER(t);
+
+    SB_STAT(sb, eagain_ct, 1);
+
+    if ((*tries)++ < SHARKYBUF_WAIT_SPIN_LIMIT) {
+        SB_STAT(sb, spin_ct, 1);
+
+        for (int i = 0; i < SHARKYBUF_WAIT_SPIN_PAUSES; i++)
+            sb_cpu_relax_();
+
+        SB_STAT_BLOCKED(sb, t);
+        return;
+    }
+
+    SB_STAT(sb, poll_ct, 1);
+
+    for (int i = 0; i < 2; i++) {
+        if (fds[i] == -1) continue;
+
+        pfd.fd = fds[i];
+        pfd.events = events[i];
+
+        // POLLERR/POLLHUP wake us too - the caller's retry then sees them
+        if (poll(&pfd, 1, -1) == -1 && errno != EINTR) {
+            perror("[sb_wait_] poll");
+            exit(4);
+        }
+    }
+
+    SB_STAT_BLOCKED(sb, t);
+}
+
 void sb_create_mmap(struct sharkybuf *sb, size_t len) {
     /*
      * Create a buffer, allocated by mmap(...) with MAP_ANONYMOUS flag
@@ -40,6 +307,9 @@ void sb_create_mmap(struct sharkybuf *sb, size_t len) {
     assert(sb != NULL);
     assert((len % (size_t)sysconf(_SC_PAGESIZE)) == 0);
 
+    // Count it, waiting for room under the soft limit if need be
+    sb_mem_charge_(SHARKYBUF_STRATEGY_MMAP, len);
+
     // Perform mmap
     addr = mmap(0, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
 
@@ -48,18 +318,92 @@ void sb_create_mmap(struct sharkybuf *sb, size_t len) {
         exit(4);
     }
 
-    // Zero buffer
-    memset(addr, 0, len);
+    // Fresh anonymous pages are already zeroed - no memset, and no faulting
+    // in pages that never get written to
 
     // Populate struct
     sb->strategy = SHARKYBUF_STRATEGY_MMAP;
     sb->addr = addr;
     sb->len = len;
     sb->dirty = false;
+    sb->dirty_len = 0;
 
     // Initialize "writer head" position
     sb->writer_ptr = (char*)addr;
     sb->writer_len_remaining = len;
+
+    sb->pool = NULL;
+    sb->slab = NULL;
+    sb->pagealloc = NULL;
+    sb->framed = false;
+    sb->frame_record_ct = 0;
+    SB_STAT_RESET(sb);
+    SB_STAT(sb, pages_alloc, sb_pages_(len));
+}
+
+void sb_create_mmap_huge(struct sharkybuf *sb, size_t len) {
+    /*
+     * Create a buffer like sb_create_mmap(...), but aligned to and sized in
+     * whole huge pages, and marked MADV_HUGEPAGE before anything touches it
+     * so that transparent huge pages can back it. Disposed of as an mmap
+     * buffer.
+     *
+     * Asserts:
+     *      sb is not null
+     *      len is an exact multiple of SHARKYBUF_HUGEPAGE_LEN
+     */
+    char       *addr, *aligned;
+    size_t      map_len, head_len, tail_len;
+
+    // Pre-flight checks
+    assert(sb != NULL);
+    assert(len > 0 && (len % SHARKYBUF_HUGEPAGE_LEN) == 0);
+
+    // Count it, waiting for room under the soft limit if need be
+    sb_mem_charge_(SHARKYBUF_STRATEGY_MMAP, len);
+
+    // Map one huge page extra, then trim down to an aligned range
+    map_len = len + SHARKYBUF_HUGEPAGE_LEN;
+    addr = mmap(0, map_len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if (addr == MAP_FAILED) {
+        perror("[sb_create_mmap_huge] mmap");
+        exit(4);
+    }
+
+    aligned = (char*)(((uintptr_t)addr + SHARKYBUF_HUGEPAGE_LEN - 1) & ~(uintptr_t)(SHARKYBUF_HUGEPAGE_LEN - 1));
+    head_len = (size_t)(aligned - addr);
+    tail_len = map_len - head_len - len;
+
+    if ((head_len > 0 && munmap(addr, head_len) == -1) ||
+        (tail_len > 0 && munmap(aligned + len, tail_len) == -1)) {
+        perror("[sb_create_mmap_huge] munmap");
+        exit(4);
+    }
+
+    // Best effort - THP may be disabled, in which case we get normal pages.
+    // Fresh anonymous pages are already zeroed, and zeroing them here would
+    // fault them in before khugepaged could help, so don't.
+    madvise(aligned, len, MADV_HUGEPAGE);
+
+    // Populate struct
+    sb->strategy = SHARKYBUF_STRATEGY_MMAP;
+    sb->addr = aligned;
+    sb->len = len;
+    sb->dirty = false;
+    sb->dirty_len = 0;
+
+    // Initialize "writer head" position
+    sb->writer_ptr = aligned;
+    sb->writer_len_remaining = len;
+
+    sb->pool = NULL;
+    sb->slab = NULL;
+    sb->pagealloc = NULL;
+    sb->framed = false;
+    sb->frame_record_ct = 0;
+    SB_STAT_RESET(sb);
+    SB_STAT(sb, pages_alloc, sb_pages_(len));
 }
 
 void sb_create_posix_memalign(struct sharkybuf *sb, size_t len) {
@@ -77,6 +421,9 @@ void sb_create_posix_memalign(struct sharkybuf *sb, size_t len) {
     assert(sb != NULL);
     assert((len % (size_t)sysconf(_SC_PAGESIZE)) == 0);
 
+    // Count it, waiting for room under the soft limit if need be
+    sb_mem_charge_(SHARKYBUF_STRATEGY_POSIX_MEMALIGN, len);
+
     // Perform allocation
     pma_rv = posix_memalign((void**)&addr, (size_t)sysconf(_SC_PAGESIZE), len);
 
@@ -95,10 +442,19 @@ void sb_create_posix_memalign(struct sharkybuf *sb, size_t len) {
     sb->addr = addr;
     sb->len = len;
     sb->dirty = false;
+    sb->dirty_len = 0;
 
     // Initialize "writer head" position
     sb->writer_ptr = (char*)addr;
     sb->writer_len_remaining = len;
+
+    sb->pool = NULL;
+    sb->slab = NULL;
+    sb->pagealloc = NULL;
+    sb->framed = false;
+    sb->frame_record_ct = 0;
+    SB_STAT_RESET(sb);
+    SB_STAT(sb, pages_alloc, sb_pages_(len));
 }
 
 void sb_create_malloc(struct sharkybuf *sb, size_t len) {
@@ -115,6 +471,9 @@ void sb_create_malloc(struct sharkybuf *sb, size_t len) {
     assert(sb != NULL);
     assert(len > 0);
 
+    // Count it, waiting for room under the soft limit if need be
+    sb_mem_charge_(SHARKYBUF_STRATEGY_MALLOC, len);
+
     // Perform allocation
     addr = malloc(len);
 
@@ -131,354 +490,3233 @@ void sb_create_malloc(struct sharkybuf *sb, size_t len) {
     sb->addr = addr;
     sb->len = len;
     sb->dirty = false;
+    sb->dirty_len = 0;
 
     // Initialize "writer head" position
     sb->writer_ptr = (char*)addr;
     sb->writer_len_remaining = len;
+
+    sb->pool = NULL;
+    sb->slab = NULL;
+    sb->pagealloc = NULL;
+    sb->framed = false;
+    sb->frame_record_ct = 0;
+    SB_STAT_RESET(sb);
+    SB_STAT(sb, pages_alloc, sb_pages_(len));
 }
 
-void sb_realloc(struct sharkybuf *sb, size_t new_len) {
+void sb_create_external(struct sharkybuf *sb, void *addr, size_t len) {
     /*
-     * Realloc(3) a buffer previously allocated by malloc(3),
-     * to have a new size of new_len
+     * Wrap len bytes of memory at addr, owned and freed by someone else
+     * (e.g. a slot in a sharkyring), in a sharkybuf. Unlike the other
+     * sb_create_* functions this does not zero the memory, so all of it
+     * counts as dirty for the first sb_wipe(...).
      *
      * Asserts:
      *      sb is not null
-     *      sb->strategy is SHARKYBUF_STRATEGY_MALLOC
-     *      new_len > 0
-     *      new_len > sb->len
+     *      addr is not null
+     *      len > 0
      */
-    void       *new_addr;
-    void       *old_addr;
-    size_t      old_len;
-    ptrdiff_t   addr_delta;
-    size_t      len_delta;
 
     // Pre-flight checks
     assert(sb != NULL);
-    assert(sb->strategy == SHARKYBUF_STRATEGY_MALLOC);
-    assert(new_len > 0);
-    assert(new_len > sb->len);
-
-    // Prep
-    old_addr = sb->addr;
-    old_len = sb->len;
-    len_delta = new_len - old_len;
-
-    // Perform allocation
-    new_addr = realloc(old_addr, new_len);
-
-    if (new_addr == NULL) {
-        perror("[sb_realloc] realloc");
-        exit(4);
-    }
-
-    // Zero new part of buffer
-    memset((new_addr + old_len), 0, (new_len - old_len));
+    assert(addr != NULL);
+    assert(len > 0);
 
-    // Calculate difference in addresses
-    addr_delta = new_addr - old_addr;
+    // Populate struct
+    sb->strategy = SHARKYBUF_STRATEGY_EXTERNAL;
+    sb->addr = addr;
+    sb->len = len;
+    sb->dirty = false;
+    sb->dirty_len = len;
 
-    // Update struct
-    sb->addr = new_addr;
-    sb->len = new_len;
+    // Initialize "writer head" position
+    sb->writer_ptr = (char*)addr;
+    sb->writer_len_remaining = len;
 
-    // Update "writer head"
-    sb->writer_ptr += addr_delta;
-    sb->writer_len_remaining += len_delta;
+    sb->pool = NULL;
+    sb->slab = NULL;
+    sb->pagealloc = NULL;
+    sb->framed = false;
+    sb->frame_record_ct = 0;
+    SB_STAT_RESET(sb);
 }
 
-void sb_dispose_munmap_(struct sharkybuf *sb) {
+static char sb_filemap_empty_[1];
+
+void sb_create_filemap(struct sharkybuf *sb, const char *path, struct sb_fault_cost *cost) {
     /*
-     * Dispose of buffer we allocated previously with mmap(2)
+     * Map the whole of the file at path read-only into a buffer, without
+     * copying it. The mapping is pre-faulted with MAP_POPULATE, so nothing
+     * stalls on the disk once we're under way, and hinted MADV_SEQUENTIAL
+     * and MADV_WILLNEED so that pages that do get dropped are read back
+     * with aggressive read-ahead. The file itself is closed again straight
+     * away, the mapping doesn't need it.
+     *
+     * An empty file can't be mapped; it gives an empty buffer instead.
+     *
+     * The buffer counts as full and must not be written to, wiped or
+     * rewound. If cost is not NULL, the page faults taken and time spent
+     * mapping and populating are stored there.
      *
      * Asserts:
-     *      sb is not NULL
-     *      sb->strategy is SHARKYBUF_STRATEGY_MMAP
+     *      sb is not null
+     *      path is not null
      */
+    int                 fd;
+    struct stat         st;
+    size_t              len;
+    void               *addr;
+    struct rusage       ru_before, ru_after;
+    struct timespec     ts_before, ts_after;
 
     // Pre-flight checks
     assert(sb != NULL);
-    assert(sb->strategy == SHARKYBUF_STRATEGY_MMAP);
+    assert(path != NULL);
 
-    // Actually unmap the memory-mapped page(s)
-    munmap(sb->addr, sb->len);
+    fd = open(path, O_RDONLY);
 
-    // Clear struct
-    sb->strategy = SHARKYBUF_STRATEGY_UNALLOCATED;
-    sb->addr = NULL;
-    sb->len = 0;
-    sb->dirty = false;
-    sb->writer_ptr = NULL;
+    if (fd == -1) {
+        perror("[sb_create_filemap] open");
+        exit(4);
+    }
+
+    if (fstat(fd, &st) == -1) {
+        perror("[sb_create_filemap] fstat");
+        exit(4);
+    }
+
+    len = (size_t)st.st_size;
+
+    // Count it, waiting for room under the soft limit if need be
+    sb_mem_charge_(SHARKYBUF_STRATEGY_FILEMAP, len);
+
+    // Map and populate, counting what that costs
+    if (getrusage(RUSAGE_THREAD, &ru_before) == -1 ||
+        clock_gettime(CLOCK_MONOTONIC, &ts_before) == -1) {
+        perror("[sb_create_filemap] getrusage/clock_gettime");
+        exit(4);
+    }
+
+    if (len > 0) {
+        addr = mmap(0, len, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+
+        if (addr == MAP_FAILED) {
+            perror("[sb_create_filemap] mmap");
+            exit(4);
+        }
+
+        // Best effort - only hints
+        madvise(addr, len, MADV_SEQUENTIAL);
+        madvise(addr, len, MADV_WILLNEED);
+    } else {
+        addr = sb_filemap_empty_;
+    }
+
+    if (getrusage(RUSAGE_THREAD, &ru_after) == -1 ||
+        clock_gettime(CLOCK_MONOTONIC, &ts_after) == -1) {
+        perror("[sb_create_filemap] getrusage/clock_gettime");
+        exit(4);
+    }
+
+    if (close(fd) == -1) {
+        perror("[sb_create_filemap] close");
+        exit(4);
+    }
+
+    if (cost != NULL) {
+        cost->minflt = ru_after.ru_minflt - ru_before.ru_minflt;
+        cost->majflt = ru_after.ru_majflt - ru_before.ru_majflt;
+        cost->ns = (unsigned long long)(ts_after.tv_sec - ts_before.tv_sec) * 1000000000ULL
+                   + (unsigned long long)ts_after.tv_nsec - (unsigned long long)ts_before.tv_nsec;
+    }
+
+    // Populate struct
+    sb->strategy = SHARKYBUF_STRATEGY_FILEMAP;
+    sb->addr = addr;
+    sb->len = len;
+    sb->dirty = (len > 0);
+    sb->dirty_len = len;
+
+    // Writer head at the end - there's no room to append
+    sb->writer_ptr = (char*)addr + len;
     sb->writer_len_remaining = 0;
+
+    sb->pool = NULL;
+    sb->slab = NULL;
+    sb->pagealloc = NULL;
+    sb->framed = false;
+    sb->frame_record_ct = 0;
+    SB_STAT_RESET(sb);
+    SB_STAT(sb, bytes_in, len);
 }
 
-void sb_dispose_free_(struct sharkybuf *sb) {
+void sb_create_pool(struct sharkybuf *sb, struct sb_pool *pool, size_t len) {
     /*
-     * Dispose of buffer we allocated previously with either
-     * posix_memalign(3) or malloc(3)
+     * Create a buffer from the next len bytes of the pool's current slab.
+     * Slab pages are pre-faulted and still zero, so there is no memset and
+     * (normally) no syscall here. When the slab runs low, the refill thread
+     * is asked to map the next one in the background.
      *
      * Asserts:
-     *      sb is not NULL
-     *      sb->addr is not NULL
-     *      sb->strategy is SHARKYBUF_STRATEGY_POSIX_MEMALIGN
-     *                   or SHARKYBUF_STRATEGY_MALLOC
+     *      sb is not null
+     *      pool is not null
+     *      len is an exact multiple of system page size
+     *      len is no larger than the pool's slab size
      */
 
     // Pre-flight checks
     assert(sb != NULL);
-    assert(sb->addr != NULL);
-    assert((sb->strategy == SHARKYBUF_STRATEGY_POSIX_MEMALIGN) ||
-           (sb->strategy == SHARKYBUF_STRATEGY_MALLOC));
+    assert(pool != NULL);
+    assert((len % (size_t)sysconf(_SC_PAGESIZE)) == 0);
+    assert(len > 0 && len <= pool->slab_len);
 
-    // Actually free the page(s)
-    free(sb->addr);
+    // Move on to the spare slab if the current one can't fit this buffer
+    if ((pool->cur->len - pool->cur->handed_out) < len)
+        sb_pool_next_slab_(pool);
 
-    // Clear struct
-    sb->strategy = SHARKYBUF_STRATEGY_UNALLOCATED;
-    sb->addr = NULL;
-    sb->len = 0;
+    // Populate struct
+    sb->strategy = SHARKYBUF_STRATEGY_POOL;
+    sb->addr = pool->cur->addr + pool->cur->handed_out;
+    sb->len = len;
     sb->dirty = false;
-    sb->writer_ptr = NULL;
-    sb->writer_len_remaining = 0;
-}
+    sb->dirty_len = 0;
 
-void sb_dispose(struct sharkybuf *sb) {
-    switch (sb->strategy) {
-        case SHARKYBUF_STRATEGY_MMAP:
-            sb_dispose_munmap_(sb);
-            break;
-        case SHARKYBUF_STRATEGY_POSIX_MEMALIGN:
-        case SHARKYBUF_STRATEGY_MALLOC:
-            sb_dispose_free_(sb);
-            break;
-        default:
-            fprintf(stderr, "[sb_dispose] invalid strategy %d.\n", sb->strategy);
-            abort();
-    }
+    // Initialize "writer head" position
+    sb->writer_ptr = (char*)(sb->addr);
+    sb->writer_len_remaining = len;
+
+    sb->pool = pool;
+    sb->slab = pool->cur;
+    sb->pagealloc = NULL;
+    sb->framed = false;
+    sb->frame_record_ct = 0;
+    SB_STAT_RESET(sb);
+
+    pool->cur->handed_out += len;
+
+    // Ask for a spare in good time, so we never wait on mmap
+    if ((pool->cur->len - pool->cur->handed_out) < pool->low_water)
+        sb_pool_want_refill_(pool);
 }
 
-void sb_wipe(struct sharkybuf *sb) {
+void sb_create_pagecache(struct sharkybuf *sb, struct sb_pagecache *pc) {
     /*
-     * Wipe buffer, reset "writer head" position and clear dirty flag
+     * Create a buffer of one page from page allocator pc->pa, through this
+     * thread's cache pc. Pages that have been used before are zeroed here;
+     * fresh ones are still zero.
      *
      * Asserts:
-     *      sb is not NULL
-     *      sb->addr is not NULL
+     *      sb is not null
+     *      pc is not null
      */
+    void       *addr;
+    bool        fresh;
 
     // Pre-flight checks
     assert(sb != NULL);
-    assert(sb->addr != NULL);
+    assert(pc != NULL);
 
-    // Zero buffer
-    memset(sb->addr, 0, sb->len);
+    addr = sb_pagecache_get(pc, &fresh);
 
-    // Initialize "writer head" position
-    sb->writer_ptr = (char*)(sb->addr);
-    sb->writer_len_remaining = sb->len;
+    // Zero buffer, unless nobody has written to it yet
+    if (!fresh)
+        memset(addr, 0, pc->pa->page_len);
 
-    // Reset dirty flag
+    // Populate struct
+    sb->strategy = SHARKYBUF_STRATEGY_PAGECACHE;
+    sb->addr = addr;
+    sb->len = pc->pa->page_len;
     sb->dirty = false;
+    sb->dirty_len = 0;
+
+    // Initialize "writer head" position
+    sb->writer_ptr = (char*)addr;
+    sb->writer_len_remaining = sb->len;
+
+    sb->pool = NULL;
+    sb->slab = NULL;
+    sb->pagealloc = pc->pa;
+    sb->framed = false;
+    sb->frame_record_ct = 0;
+    SB_STAT_RESET(sb);
 }
 
-int sb_append_line_or_zeroes(struct sharkybuf *sb, char *line) {
+void sb_realloc_malloc_(struct sharkybuf *sb, size_t new_len) {
     /*
-     * Append value of line followed by '\n' to buffer if there is
-     * enough room. On detecting that snprintf has truncated the text
-     * to append, zero out the remainder of the buffer.
-     *
-     * Returns:
-     *      0 on success
-     *      1 if remaining buffer was insufficient, and was zeroed
+     * Realloc(3) a buffer previously allocated by malloc(3),
+     * to have a new size of new_len
      *
      * Asserts:
-     *      sb is not NULL
-     *      sb->addr is not NULL
-     *      line is not NULL
+     *      sb is not null
+     *      sb->strategy is SHARKYBUF_STRATEGY_MALLOC
+     *      new_len > sb->len
      */
-    int snp_rv;
+    char       *new_addr;
+    size_t      old_len;
+    size_t      writer_off;
 
     // Pre-flight checks
     assert(sb != NULL);
-    assert(sb->addr != NULL);
-    assert(line != NULL);
+    assert(sb->strategy == SHARKYBUF_STRATEGY_MALLOC);
+    assert(new_len > sb->len);
 
-    // Append string + newline to buffer
-    //
-    // Return value snp_rv is length of text that *ought* to have been written,
-    // NOT INCLUDING the '\0' byte.
-    snp_rv = snprintf(sb->writer_ptr, (sb->writer_len_remaining / sizeof(char)), "%s\n", line);
-    sb->dirty = true;
+    // Prep - the old address mustn't be used once realloc(3) has moved it
+    old_len = sb->len;
+    writer_off = (size_t)(sb->writer_ptr - (char*)(sb->addr));
 
-    if (snp_rv < 0) {
-        perror("[sb_append_line_or_zeroes] snprintf");
+    // Count it, waiting for room under the soft limit if need be
+    sb_mem_charge_(SHARKYBUF_STRATEGY_MALLOC, new_len - old_len);
+
+    // Perform allocation
+    new_addr = realloc(sb->addr, new_len);
+
+    if (new_addr == NULL) {
+        perror("[sb_realloc_malloc_] realloc");
         exit(4);
     }
 
-    if ((size_t)(snp_rv * sizeof(char)) >= sb->writer_len_remaining) {
-        memset(sb->writer_ptr, 0, sb->writer_len_remaining);
-        return 1;
-    } else {
-        // Deliberately update pointer to point at location of '\0',
-        // as we'll overwrite that with a new null-terminated string
-        sb->writer_len_remaining -= (size_t)(snp_rv * sizeof(char));
-        sb->writer_ptr += snp_rv;
-        return 0;
-    }
+    // Zero new part of buffer
+    memset((new_addr + old_len), 0, (new_len - old_len));
+
+    SB_STAT(sb, pages_alloc, sb_pages_(new_len) - sb_pages_(old_len));
+
+    // Update struct
+    sb->addr = new_addr;
+    sb->len = new_len;
 
+    // Update "writer head"
+    sb->writer_ptr = new_addr + writer_off;
+    sb->writer_len_remaining += (new_len - old_len);
 }
 
-int sb_recvbuf_read(struct sharkybuf *sb, int fd) {
+void sb_realloc_mremap_(struct sharkybuf *sb, size_t new_len) {
     /*
-     * Read from pipe fd until either buffer is full or EOF is reached
-     *
-     * Returns:
-     *      0 if we filled our buffer without reaching EOF
-     *      1 if we reached EOF
+     * Grow a buffer previously allocated by mmap(...) to new_len bytes
+     * using mremap(... MREMAP_MAYMOVE). If the mapping has to move, the
+     * kernel moves the page tables rather than copying the data, and the
+     * new pages are fresh anonymous memory, already zeroed, so growing
+     * costs nothing per byte until the new part is written to.
      *
      * Asserts:
-     *      sb is not NULL
-     *      sb->addr is not NULL
+     *      sb is not null
+     *      sb->strategy is SHARKYBUF_STRATEGY_MMAP
+     *      new_len > sb->len
+     *      new_len is an exact multiple of system page size
      */
-
-    ssize_t         rd_rv;
+    char       *new_addr;
+    size_t      old_len;
+    size_t      writer_off;
 
     // Pre-flight checks
     assert(sb != NULL);
-    assert(sb->addr != NULL);
+    assert(sb->strategy == SHARKYBUF_STRATEGY_MMAP);
+    assert(new_len > sb->len);
+    assert((new_len % (size_t)sysconf(_SC_PAGESIZE)) == 0);
 
-    // Read
-    while (true) {
-        rd_rv = read(fd, sb->writer_ptr, sb->writer_len_remaining);
+    // Prep
+    old_len = sb->len;
+    writer_off = (size_t)(sb->writer_ptr - (char*)(sb->addr));
 
-        // Check if we actually managed to read anything,
-        // and handle retries and errors
-        if (rd_rv < 0) {
-            switch (errno) {
-                case EINTR:
-                case EAGAIN:
-                    // Try again
-                    continue;
-                default:
-                    perror("[sb_recvbuf_read] read");
-                    exit(4);
-            }
-        } else {
-            sb->dirty = true;
-            sb->writer_ptr += (rd_rv / sizeof(char));
-            sb->writer_len_remaining -= ((rd_rv / sizeof(char))  * sizeof(char));
-        }
+    // Count it, waiting for room under the soft limit if need be
+    sb_mem_charge_(SHARKYBUF_STRATEGY_MMAP, new_len - old_len);
 
-        // Check if we've reached EOF
-        if(rd_rv == 0) return 1;
+    // Perform remap
+    new_addr = mremap(sb->addr, old_len, new_len, MREMAP_MAYMOVE);
 
-        // Check if we're out of buffer
-        if(!(sb->writer_len_remaining > 0)) return 0;
+    if (new_addr == MAP_FAILED) {
+        perror("[sb_realloc_mremap_] mremap");
+        exit(4);
     }
+
+    SB_STAT(sb, pages_alloc, sb_pages_(new_len) - sb_pages_(old_len));
+
+    // Update struct
+    sb->addr = new_addr;
+    sb->len = new_len;
+
+    // Update "writer head"
+    sb->writer_ptr = new_addr + writer_off;
+    sb->writer_len_remaining += (new_len - old_len);
 }
 
-void sb_sendbuf_vmsplice(struct sharkybuf *sb, int fd) {
+void sb_realloc(struct sharkybuf *sb, size_t new_len) {
+    /*
+     * Grow buffer sb to new_len bytes, keeping its contents and the
+     * position of its writer head. The buffer may move.
+     */
+    switch (sb->strategy) {
+        case SHARKYBUF_STRATEGY_MALLOC:
+            sb_realloc_malloc_(sb, new_len);
+            break;
+        case SHARKYBUF_STRATEGY_MMAP:
+            sb_realloc_mremap_(sb, new_len);
+            break;
+        default:
+            fprintf(stderr, "[sb_realloc] strategy %d can't be grown.\n", sb->strategy);
+            abort();
+    }
+}
+
+void sb_dispose_munmap_(struct sharkybuf *sb) {
     /*
-     * Send content of buffer sb to pipe fd, then dispose of buffer
-     * and replace with a new one as we are not allowed to touch these
-     * pages once we've given them away with vmsplice(... SPLICE_F_GIFT)
+     * Dispose of buffer we allocated previously with mmap(2)
      *
      * Asserts:
      *      sb is not NULL
-     *      sb->addr is not NULL
      *      sb->strategy is SHARKYBUF_STRATEGY_MMAP
      */
 
-    size_t          len;
-    struct iovec    iov;
-    size_t          reader_len_remaining;
-    ssize_t         vms_rv;
+    // Pre-flight checks
+    assert(sb != NULL);
+    assert(sb->strategy == SHARKYBUF_STRATEGY_MMAP);
+
+    // Actually unmap the memory-mapped page(s)
+    munmap(sb->addr, sb->len);
+    SB_STAT(sb, pages_freed, sb_pages_(sb->len));
+    sb_mem_uncharge_(SHARKYBUF_STRATEGY_MMAP, sb->len);
+
+    // Clear struct
+    sb->strategy = SHARKYBUF_STRATEGY_UNALLOCATED;
+    sb->addr = NULL;
+    sb->len = 0;
+    sb->dirty = false;
+    sb->writer_ptr = NULL;
+    sb->writer_len_remaining = 0;
+    sb->pool = NULL;
+    sb->slab = NULL;
+    sb->pagealloc = NULL;
+    sb->framed = false;
+    sb->frame_record_ct = 0;
+}
+
+void sb_dispose_free_(struct sharkybuf *sb) {
+    /*
+     * Dispose of buffer we allocated previously with either
+     * posix_memalign(3) or malloc(3)
+     *
+     * Asserts:
+     *      sb is not NULL
+     *      sb->addr is not NULL
+     *      sb->strategy is SHARKYBUF_STRATEGY_POSIX_MEMALIGN
+     *                   or SHARKYBUF_STRATEGY_MALLOC
+     */
 
     // Pre-flight checks
     assert(sb != NULL);
     assert(sb->addr != NULL);
-    assert(sb->strategy == SHARKYBUF_STRATEGY_MMAP);
+    assert((sb->strategy == SHARKYBUF_STRATEGY_POSIX_MEMALIGN) ||
+           (sb->strategy == SHARKYBUF_STRATEGY_MALLOC));
 
-    // Setup
-    reader_len_remaining = sb->len;
-    iov.iov_base = sb->addr;
-    iov.iov_len = reader_len_remaining;
+    // Actually free the page(s)
+    free(sb->addr);
+    SB_STAT(sb, pages_freed, sb_pages_(sb->len));
+    sb_mem_uncharge_(sb->strategy, sb->len);
 
-    // Transfer
-    while (reader_len_remaining) {
-        vms_rv = vmsplice(fd, &iov, 1, SPLICE_F_GIFT);
+    // Clear struct
+    sb->strategy = SHARKYBUF_STRATEGY_UNALLOCATED;
+    sb->addr = NULL;
+    sb->len = 0;
+    sb->dirty = false;
+    sb->writer_ptr = NULL;
+    sb->writer_len_remaining = 0;
+    sb->pool = NULL;
+    sb->slab = NULL;
+    sb->pagealloc = NULL;
+    sb->framed = false;
+    sb->frame_record_ct = 0;
+}
 
-        if (vms_rv < 0) {
-            switch (errno) {
-                case EAGAIN:
-                    // Try again
-                    continue;
-                default:
-                    perror("[sb_sendbuf_vmsplice] vmsplice");
-                    exit(4);
-            }
-        } else {
-            reader_len_remaining -= vms_rv;
-            iov.iov_base += vms_rv;
-            iov.iov_len -= vms_rv;
-        }
+void sb_dispose_filemap_(struct sharkybuf *sb) {
+    /*
+     * Dispose of buffer we mapped previously with sb_create_filemap(...)
+     *
+     * Asserts:
+     *      sb is not NULL
+     *      sb->strategy is SHARKYBUF_STRATEGY_FILEMAP
+     */
+
+    // Pre-flight checks
+    assert(sb != NULL);
+    assert(sb->strategy == SHARKYBUF_STRATEGY_FILEMAP);
+
+    // Empty files were never mapped
+    if (sb->len > 0 && munmap(sb->addr, sb->len) == -1) {
+        perror("[sb_dispose_filemap_] munmap");
+        exit(4);
     }
 
-    // Dispose and replace
-    len = sb->len;
-    sb_dispose(sb);
-    sb_create_mmap(sb, len);
+    sb_mem_uncharge_(SHARKYBUF_STRATEGY_FILEMAP, sb->len);
+
+    // Clear struct
+    sb->strategy = SHARKYBUF_STRATEGY_UNALLOCATED;
+    sb->addr = NULL;
+    sb->len = 0;
+    sb->dirty = false;
+    sb->writer_ptr = NULL;
+    sb->writer_len_remaining = 0;
+    sb->pool = NULL;
+    sb->slab = NULL;
+    sb->pagealloc = NULL;
+    sb->framed = false;
+    sb->frame_record_ct = 0;
 }
 
-void sb_buf_to_stdout(struct sharkybuf *sb) {
+void sb_dispose_pool_(struct sharkybuf *sb) {
     /*
-     * Send content of buffer sb to stdout using write(2), except for
-     * any null bytes at the end of the buffer 
+     * Dispose of buffer handed out by a sb_pool. The memory is not reused;
+     * once every buffer from a slab has been disposed of, the whole slab
+     * is passed to the refill thread to be unmapped.
      *
      * Asserts:
      *      sb is not NULL
-     *      sb->addr is not NULL
+     *      sb->strategy is SHARKYBUF_STRATEGY_POOL
      */
 
-    char           *reader_ptr;
-    size_t          reader_len_remaining;
-    ssize_t         wr_rv;
-
     // Pre-flight checks
     assert(sb != NULL);
-    assert(sb->addr != NULL);
+    assert(sb->strategy == SHARKYBUF_STRATEGY_POOL);
 
-    // Setup
-    reader_ptr = sb->addr;
-    reader_len_remaining = sb->len;
+    sb_pool_release_(sb->pool, sb->slab, sb->len);
 
-    // Adjust reader_len_remaining so that we don't write nulls to the terminal
-    for ( ; reader_len_remaining >= sizeof(char); ) {
-        if (reader_ptr[(reader_len_remaining/sizeof(char))-1] == '\0') {
-            reader_len_remaining -= sizeof(char);
-        } else {
-            break;
-        }
+    // Clear struct
+    sb->strategy = SHARKYBUF_STRATEGY_UNALLOCATED;
+    sb->addr = NULL;
+    sb->len = 0;
+    sb->dirty = false;
+    sb->writer_ptr = NULL;
+    sb->writer_len_remaining = 0;
+    sb->pool = NULL;
+    sb->slab = NULL;
+    sb->pagealloc = NULL;
+    sb->framed = false;
+    sb->frame_record_ct = 0;
+}
+
+static __thread struct sb_pagecache *sb_pagecache_bound_;
+
+void sb_dispose_pagecache_(struct sharkybuf *sb) {
+    /*
+     * Dispose of buffer from a page allocator. The page goes to the cache
+     * bound to this thread with sb_pagecache_bind(...) if there is one for
+     * that allocator - so a consumer thread's cache fills up with pages to
+     * pass back to producers through the depot - or else straight into
+     * the depot on its own.
+     *
+     * Asserts:
+     *      sb is not NULL
+     *      sb->strategy is SHARKYBUF_STRATEGY_PAGECACHE
+     */
+    struct sb_pagecache     lone;
+
+    // Pre-flight checks
+    assert(sb != NULL);
+    assert(sb->strategy == SHARKYBUF_STRATEGY_PAGECACHE);
+
+    if (sb_pagecache_bound_ != NULL && sb_pagecache_bound_->pa == sb->pagealloc) {
+        sb_pagecache_put(sb_pagecache_bound_, sb->addr);
+    } else {
+        sb_pagecache_init(&lone, sb->pagealloc);
+        sb_pagecache_put(&lone, sb->addr);
+        sb_pagecache_flush(&lone);
     }
 
-    // Start writing to stdout
-    while (reader_len_remaining > 0) {
-        wr_rv = write(fileno(stdout), reader_ptr, reader_len_remaining);
+    // Clear struct
+    sb->strategy = SHARKYBUF_STRATEGY_UNALLOCATED;
+    sb->addr = NULL;
+    sb->len = 0;
+    sb->dirty = false;
+    sb->writer_ptr = NULL;
+    sb->writer_len_remaining = 0;
+    sb->pool = NULL;
+    sb->slab = NULL;
+    sb->pagealloc = NULL;
+    sb->framed = false;
+    sb->frame_record_ct = 0;
+}
 
-        if (wr_rv < 0) {
-            switch (errno) {
-                case EINTR:
-                case EAGAIN:
-                    // Try again
-                    continue;
-                default:
-                    perror("[sb_buf_to_stdout] write");
-                    exit(4);
-            }
+void sb_dispose(struct sharkybuf *sb) {
+    switch (sb->strategy) {
+        case SHARKYBUF_STRATEGY_MMAP:
+            sb_dispose_munmap_(sb);
+            break;
+        case SHARKYBUF_STRATEGY_POSIX_MEMALIGN:
+        case SHARKYBUF_STRATEGY_MALLOC:
+            sb_dispose_free_(sb);
+            break;
+        case SHARKYBUF_STRATEGY_POOL:
+            sb_dispose_pool_(sb);
+            break;
+        case SHARKYBUF_STRATEGY_FILEMAP:
+            sb_dispose_filemap_(sb);
+            break;
+        case SHARKYBUF_STRATEGY_PAGECACHE:
+            sb_dispose_pagecache_(sb);
+            break;
+        case SHARKYBUF_STRATEGY_EXTERNAL:
+            // Memory belongs to someone else, just clear struct
+            sb->strategy = SHARKYBUF_STRATEGY_UNALLOCATED;
+            sb->addr = NULL;
+            sb->len = 0;
+            sb->dirty = false;
+            sb->writer_ptr = NULL;
+            sb->writer_len_remaining = 0;
+            sb->pool = NULL;
+            sb->slab = NULL;
+            sb->pagealloc = NULL;
+            sb->framed = false;
+            sb->frame_record_ct = 0;
+            break;
+        default:
+            fprintf(stderr, "[sb_dispose] invalid strategy %d.\n", sb->strategy);
+            abort();
+    }
+}
+
+void sb_wipe(struct sharkybuf *sb) {
+    /*
+     * Wipe buffer, reset "writer head" position and clear dirty flag.
+     *
+     * Only the dirty extent - as far as the writer head has been since the
+     * buffer was last wiped - is zeroed, so wiping costs what was written
+     * rather than sb->len. mmap buffers with a dirty extent of at least
+     * SHARKYBUF_WIPE_DONTNEED_LEN drop its whole pages with MADV_DONTNEED
+     * instead: they come back as zero pages when next touched, and until
+     * then take up no memory.
+     *
+     * Framed buffers are not zeroed, as the frame header says how much of
+     * the buffer is valid; the writer head goes back to just after the header.
+     *
+     * Asserts:
+     *      sb is not NULL
+     *      sb->addr is not NULL
+     *      sb->strategy is not SHARKYBUF_STRATEGY_FILEMAP (read-only)
+     */
+
+    size_t      extent, drop_len = 0;
+
+    // Pre-flight checks
+    assert(sb != NULL);
+    assert(sb->addr != NULL);
+    assert(sb->strategy != SHARKYBUF_STRATEGY_FILEMAP);
+
+    if (sb->framed) {
+        sb_frame_init(sb);
+        return;
+    }
+
+    extent = sb_dirty_extent_(sb);
+
+    // Drop whole pages of large extents, if we own the mapping
+    if (sb->strategy == SHARKYBUF_STRATEGY_MMAP && extent >= SHARKYBUF_WIPE_DONTNEED_LEN) {
+        drop_len = extent & ~((size_t)sysconf(_SC_PAGESIZE) - 1);
+
+        if (madvise(sb->addr, drop_len, MADV_DONTNEED) == -1) {
+            perror("[sb_wipe] madvise");
+            exit(4);
+        }
+
+        SB_STAT(sb, pages_freed, sb_pages_(drop_len));
+    }
+
+    // Zero the rest of the dirty extent
+    memset((char*)(sb->addr) + drop_len, 0, extent - drop_len);
+    sb->dirty_len = 0;
+
+    // Initialize "writer head" position
+    sb->writer_ptr = (char*)(sb->addr);
+    sb->writer_len_remaining = sb->len;
+
+    // Reset dirty flag
+    sb->dirty = false;
+}
+
+void sb_rewind(struct sharkybuf *sb) {
+    /*
+     * Reset "writer head" position and clear dirty flag, without zeroing
+     * the buffer. For buffers whose valid contents are known by other means,
+     * e.g. receive buffers holding frames.
+     *
+     * Asserts:
+     *      sb is not NULL
+     *      sb->addr is not NULL
+     *      sb->strategy is not SHARKYBUF_STRATEGY_FILEMAP (read-only)
+     */
+
+    // Pre-flight checks
+    assert(sb != NULL);
+    assert(sb->addr != NULL);
+    assert(sb->strategy != SHARKYBUF_STRATEGY_FILEMAP);
+
+    // What was written stays there, for the next sb_wipe(...) to zero
+    sb_dirty_extent_(sb);
+
+    // Initialize "writer head" position
+    sb->writer_ptr = (char*)(sb->addr);
+    sb->writer_len_remaining = sb->len;
+
+    // Reset dirty flag
+    sb->dirty = false;
+}
+
+int sb_append_line(struct sharkybuf *sb, char *line) {
+    /*
+     * Append value of line followed by '\n' to buffer if there is
+     * enough room. If there isn't, the writer head is left where it was,
+     * and anything snprintf managed to write beyond it is left in place.
+     *
+     * Returns:
+     *      0 on success
+     *      1 if remaining buffer was insufficient
+     *
+     * Asserts:
+     *      sb is not NULL
+     *      sb->addr is not NULL
+     *      line is not NULL
+     */
+    int snp_rv;
+
+    // Pre-flight checks
+    assert(sb != NULL);
+    assert(sb->addr != NULL);
+    assert(line != NULL);
+
+    // Append string + newline to buffer
+    //
+    // Return value snp_rv is length of text that *ought* to have been written,
+    // NOT INCLUDING the '\0' byte.
+    snp_rv = snprintf(sb->writer_ptr, (sb->writer_len_remaining / sizeof(char)), "%s\n", line);
+    sb->dirty = true;
+
+    if (snp_rv < 0) {
+        perror("[sb_append_line] snprintf");
+        exit(4);
+    }
+
+    // snprintf filled the rest of the buffer
+    if ((size_t)(snp_rv * sizeof(char)) >= sb->writer_len_remaining) {
+        sb->dirty_len = sb->len;
+        return 1;
+    }
+
+    // Deliberately update pointer to point at location of '\0',
+    // as we'll overwrite that with a new null-terminated string
+    sb->writer_len_remaining -= (size_t)(snp_rv * sizeof(char));
+    sb->writer_ptr += snp_rv;
+    sb->frame_record_ct++;
+    return 0;
+}
+
+int sb_append_line_or_zeroes(struct sharkybuf *sb, char *line) {
+    /*
+     * Append value of line followed by '\n' to buffer if there is
+     * enough room. On detecting that snprintf has truncated the text
+     * to append, zero out the remainder of the buffer.
+     *
+     * Returns:
+     *      0 on success
+     *      1 if remaining buffer was insufficient, and was zeroed
+     *
+     * Asserts:
+     *      sb is not NULL
+     *      sb->addr is not NULL
+     *      line is not NULL
+     */
+    int snp_rv;
+
+    // Pre-flight checks
+    assert(sb != NULL);
+    assert(sb->addr != NULL);
+    assert(line != NULL);
+
+    // Append string + newline to buffer
+    //
+    // Return value snp_rv is length of text that *ought* to have been written,
+    // NOT INCLUDING the '\0' byte.
+    snp_rv = snprintf(sb->writer_ptr, (sb->writer_len_remaining / sizeof(char)), "%s\n", line);
+    sb->dirty = true;
+
+    if (snp_rv < 0) {
+        perror("[sb_append_line_or_zeroes] snprintf");
+        exit(4);
+    }
+
+    if ((size_t)(snp_rv * sizeof(char)) >= sb->writer_len_remaining) {
+        memset(sb->writer_ptr, 0, sb->writer_len_remaining);
+        return 1;
+    } else {
+        // Deliberately update pointer to point at location of '\0',
+        // as we'll overwrite that with a new null-terminated string
+        sb->writer_len_remaining -= (size_t)(snp_rv * sizeof(char));
+        sb->writer_ptr += snp_rv;
+        sb->frame_record_ct++;
+        return 0;
+    }
+
+}
+
+size_t sb_append_bytes(struct sharkybuf *sb, const void *src, size_t len) {
+    /*
+     * Append as much of the len bytes at src to buffer as there is room
+     * for. Nothing past the new writer head is touched.
+     *
+     * Returns:
+     *      number of bytes that didn't fit, 0 if they all did
+     *
+     * Asserts:
+     *      sb is not NULL
+     *      sb->addr is not NULL
+     */
+    size_t          fit;
+
+    // Pre-flight checks
+    assert(sb != NULL);
+    assert(sb->addr != NULL);
+
+    fit = (len <= sb->writer_len_remaining) ? len : sb->writer_len_remaining;
+
+    memcpy(sb->writer_ptr, src, fit);
+    sb->writer_ptr += fit;
+    sb->writer_len_remaining -= fit;
+    sb->dirty = true;
+
+    return len - fit;
+}
+
+size_t sb_append_record(struct sharkybuf *sb, const char *rec, size_t len, char sep) {
+    /*
+     * Append the len bytes at rec, followed by sep unless sep is '\0', to
+     * buffer as a single record - all of it if there is room, otherwise
+     * none of it. Unlike sb_append_line_or_zeroes(...) the rest of the
+     * buffer is left alone, so it is only null-padded if it was to start
+     * with (fresh or wiped buffers are).
+     *
+     * Returns:
+     *      0 on success
+     *      length of the record if remaining buffer was insufficient
+     *
+     * Asserts:
+     *      sb is not NULL
+     *      sb->addr is not NULL
+     */
+    size_t          rec_len;
+
+    // Pre-flight checks
+    assert(sb != NULL);
+    assert(sb->addr != NULL);
+
+    rec_len = len + ((sep != '\0') ? 1 : 0);
+
+    if (rec_len > sb->writer_len_remaining)
+        return rec_len;
+
+    memcpy(sb->writer_ptr, rec, len);
+    if (sep != '\0') sb->writer_ptr[len] = sep;
+
+    sb->writer_ptr += rec_len;
+    sb->writer_len_remaining -= rec_len;
+    sb->dirty = true;
+    sb->frame_record_ct++;
+
+    return 0;
+}
+
+size_t sb_append_u64(struct sharkybuf *sb, uint64_t v, char sep) {
+    /*
+     * Append v in decimal, followed by sep unless sep is '\0', as a single
+     * record, without going through printf(3)
+     *
+     * Returns:
+     *      as sb_append_record(...)
+     */
+    char            digits[20];
+    char           *p = &digits[sizeof(digits)];
+
+    do {
+        *--p = (char)('0' + (v % 10));
+        v /= 10;
+    } while (v);
+
+    return sb_append_record(sb, p, (size_t)(&digits[sizeof(digits)] - p), sep);
+}
+
+size_t sb_append_u32(struct sharkybuf *sb, uint32_t v, char sep) {
+    /*
+     * As sb_append_u64(...), for 32-bit values - dividing a 32-bit value
+     * is cheaper
+     */
+    char            digits[10];
+    char           *p = &digits[sizeof(digits)];
+
+    do {
+        *--p = (char)('0' + (v % 10));
+        v /= 10;
+    } while (v);
+
+    return sb_append_record(sb, p, (size_t)(&digits[sizeof(digits)] - p), sep);
+}
+
+size_t sb_append_iov(struct sharkybuf *sb, const struct iovec *iov, int iov_ct) {
+    /*
+     * Append the iov_ct pieces described by iov to buffer, one after the
+     * other, as a single record - all of them if there is room, otherwise
+     * none of them
+     *
+     * Returns:
+     *      0 on success
+     *      total length of the pieces if remaining buffer was insufficient
+     *
+     * Asserts:
+     *      sb is not NULL
+     *      sb->addr is not NULL
+     */
+    size_t          total = 0;
+
+    // Pre-flight checks
+    assert(sb != NULL);
+    assert(sb->addr != NULL);
+
+    for (int i = 0; i < iov_ct; i++)
+        total += iov[i].iov_len;
+
+    if (total > sb->writer_len_remaining)
+        return total;
+
+    for (int i = 0; i < iov_ct; i++) {
+        memcpy(sb->writer_ptr, iov[i].iov_base, iov[i].iov_len);
+        sb->writer_ptr += iov[i].iov_len;
+    }
+
+    sb->writer_len_remaining -= total;
+    sb->dirty = true;
+    sb->frame_record_ct++;
+
+    return 0;
+}
+
+int sb_recvbuf_read(struct sharkybuf *sb, int fd) {
+    /*
+     * Read from pipe fd until either buffer is full or EOF is reached
+     *
+     * Returns:
+     *      0 if we filled our buffer without reaching EOF
+     *      1 if we reached EOF
+     *
+     * Asserts:
+     *      sb is not NULL
+     *      sb->addr is not NULL
+     */
+
+    ssize_t         rd_rv;
+    int             tries = 0;
+
+    // Pre-flight checks
+    assert(sb != NULL);
+    assert(sb->addr != NULL);
+
+    // Read
+    while (true) {
+        SB_STAT_TIMER(t);
+
+        rd_rv = read(fd, sb->writer_ptr, sb->writer_len_remaining);
+        SB_STAT_IO(sb, t, rd_rv, sb->writer_len_remaining, bytes_in);
+
+        // Check if we actually managed to read anything,
+        // and handle retries and errors
+        if (rd_rv < 0) {
+            switch (errno) {
+                case EINTR:
+                    // Try again
+                    continue;
+                case EAGAIN:
+                    // Try again, once there might be something to read
+                    sb_wait_(sb, fd, -1, &tries);
+                    continue;
+                default:
+                    perror("[sb_recvbuf_read] read");
+                    exit(4);
+            }
+        } else if (rd_rv > 0) {
+            sb->dirty = true;
+            sb->writer_ptr += (rd_rv / sizeof(char));
+            sb->writer_len_remaining -= ((rd_rv / sizeof(char))  * sizeof(char));
+        }
+
+        // Check if we've reached EOF
+        if(rd_rv == 0) return 1;
+
+        // Check if we're out of buffer
+        if(!(sb->writer_len_remaining > 0)) return 0;
+    }
+}
+
+int sb_recvbuf_read_avail(struct sharkybuf *sb, int fd) {
+    /*
+     * Read whatever is available from pipe fd (blocking until at least
+     * something is), without waiting for the buffer to fill. For consumers
+     * of live streams that want to act on data as soon as it arrives.
+     *
+     * Returns:
+     *      0 if we read something
+     *      1 if we reached EOF
+     *
+     * Asserts:
+     *      sb is not NULL
+     *      sb->addr is not NULL
+     *      sb has space remaining
+     */
+
+    ssize_t         rd_rv;
+    int             tries = 0;
+
+    // Pre-flight checks
+    assert(sb != NULL);
+    assert(sb->addr != NULL);
+    assert(sb->writer_len_remaining > 0);
+
+    // Read
+    while (true) {
+        SB_STAT_TIMER(t);
+
+        rd_rv = read(fd, sb->writer_ptr, sb->writer_len_remaining);
+        SB_STAT_IO(sb, t, rd_rv, sb->writer_len_remaining, bytes_in);
+
+        if (rd_rv < 0) {
+            switch (errno) {
+                case EINTR:
+                    // Try again
+                    continue;
+                case EAGAIN:
+                    // Try again, once there might be something to read
+                    sb_wait_(sb, fd, -1, &tries);
+                    continue;
+                default:
+                    perror("[sb_recvbuf_read_avail] read");
+                    exit(4);
+            }
+        }
+
+        if (rd_rv == 0) return 1;
+
+        sb->dirty = true;
+        sb->writer_ptr += (rd_rv / sizeof(char));
+        sb->writer_len_remaining -= ((rd_rv / sizeof(char)) * sizeof(char));
+        return 0;
+    }
+}
+
+void sb_sendbufs_vmsplice(struct sharkybuf *sbs, int sb_ct, int fd) {
+    /*
+     * Send content of the sb_ct buffers in array sbs to pipe fd, passing
+     * all of them to each vmsplice(2) call as one iovec array, then dispose
+     * of the buffers and replace them with new ones as we are not allowed
+     * to touch these pages once we've given them away with
+     * vmsplice(... SPLICE_F_GIFT)
+     *
+     * Pool buffers are replaced from the same pool, which costs no syscalls
+     * in the steady state; plain mmap buffers are unmapped and re-mapped.
+     * Framed buffers have their header filled in before they are sent, and
+     * their replacements are framed too.
+     *
+     * Asserts:
+     *      sbs is not NULL
+     *      0 < sb_ct <= SHARKYBUF_MAX_IOV
+     *      each buffer's addr is not NULL
+     *      each buffer's strategy is SHARKYBUF_STRATEGY_MMAP or SHARKYBUF_STRATEGY_POOL
+     */
+
+    size_t          len;
+    struct sb_pool *pool;
+    bool            framed;
+    struct iovec    iov[SHARKYBUF_MAX_IOV];
+    int             iov_first;
+    size_t          left = 0;
+    ssize_t         vms_rv;
+    int             tries = 0;
+
+    // Pre-flight checks
+    assert(sbs != NULL);
+    assert(sb_ct > 0 && sb_ct <= SHARKYBUF_MAX_IOV);
+
+    // Setup
+    for (int i = 0; i < sb_ct; i++) {
+        assert(sbs[i].addr != NULL);
+        assert((sbs[i].strategy == SHARKYBUF_STRATEGY_MMAP) ||
+               (sbs[i].strategy == SHARKYBUF_STRATEGY_POOL));
+
+        if (sbs[i].framed)
+            sb_frame_seal(&sbs[i]);
+
+        iov[i].iov_base = sbs[i].addr;
+        iov[i].iov_len = sbs[i].len;
+        left += sbs[i].len;
+    }
+
+    // Transfer, resuming from wherever a short transfer left off
+    iov_first = 0;
+    while (iov_first < sb_ct) {
+        SB_STAT_TIMER(t);
+
+        vms_rv = vmsplice(fd, &iov[iov_first], (unsigned long)(sb_ct - iov_first), SPLICE_F_GIFT);
+        SB_STAT_IO(NULL, t, vms_rv, left, bytes_out);
+
+        if (vms_rv < 0) {
+            switch (errno) {
+                case EINTR:
+                    // Try again
+                    continue;
+                case EAGAIN:
+                    // Try again, once the pipe has room
+                    sb_wait_(NULL, -1, fd, &tries);
+                    continue;
+                default:
+                    perror("[sb_sendbufs_vmsplice] vmsplice");
+                    exit(4);
+            }
+        }
+
+        left -= (size_t)vms_rv;
+
+        while (vms_rv > 0) {
+            if ((size_t)vms_rv >= iov[iov_first].iov_len) {
+                vms_rv -= iov[iov_first].iov_len;
+                iov_first++;
+            } else {
+                iov[iov_first].iov_base += vms_rv;
+                iov[iov_first].iov_len -= vms_rv;
+                vms_rv = 0;
+            }
+        }
+    }
+
+    // Dispose and replace
+    for (int i = 0; i < sb_ct; i++) {
+        len = sbs[i].len;
+        pool = sbs[i].pool;
+        framed = sbs[i].framed;
+        sb_dispose(&sbs[i]);
+
+        if (pool != NULL)
+            sb_create_pool(&sbs[i], pool, len);
+        else
+            sb_create_mmap(&sbs[i], len);
+
+        if (framed)
+            sb_frame_init(&sbs[i]);
+    }
+}
+
+void sb_sendbuf_vmsplice(struct sharkybuf *sb, int fd) {
+    /*
+     * Send content of buffer sb to pipe fd and replace it with a new one,
+     * see sb_sendbufs_vmsplice(...)
+     */
+    sb_sendbufs_vmsplice(sb, 1, fd);
+}
+
+size_t sb_pipe_set_size(int fd, size_t want_len) {
+    /*
+     * Try to enlarge pipe fd to hold want_len bytes with F_SETPIPE_SZ,
+     * so that a whole batch of buffers can be moved by one syscall.
+     * If the kernel won't allow that (e.g. want_len is over
+     * /proc/sys/fs/pipe-max-size), keep the current size.
+     *
+     * Returns:
+     *      the pipe's capacity in bytes, as reported by the kernel
+     */
+    int         fcntl_rv;
+
+    fcntl_rv = fcntl(fd, F_SETPIPE_SZ, (int)want_len);
+
+    if (fcntl_rv == -1) {
+        switch (errno) {
+            case EPERM:
+            case EBUSY:
+            case EINVAL:
+                // Not allowed to grow that far, stay as we are
+                fcntl_rv = fcntl(fd, F_GETPIPE_SZ);
+                break;
+            default:
+                perror("[sb_pipe_set_size] fcntl");
+                exit(4);
+        }
+    }
+
+    if (fcntl_rv == -1) {
+        perror("[sb_pipe_set_size] fcntl");
+        exit(4);
+    }
+
+    return (size_t)fcntl_rv;
+}
+
+static void sb_write_all_(struct sharkybuf *sb, int fd, const char *ptr, size_t len, const char *who) {
+    /*
+     * write(2) len bytes at ptr (from buffer sb, or NULL) to fd, retrying
+     * after short writes
+     */
+    ssize_t         wr_rv;
+    int             tries = 0;
+
+    while (len > 0) {
+        SB_STAT_TIMER(t);
+
+        wr_rv = write(fd, ptr, len);
+        SB_STAT_IO(sb, t, wr_rv, len, bytes_out);
+
+        if (wr_rv < 0) {
+            switch (errno) {
+                case EINTR:
+                    // Try again
+                    continue;
+                case EAGAIN:
+                    // Try again, once fd has room
+                    sb_wait_(sb, -1, fd, &tries);
+                    continue;
+                default:
+                    perror(who);
+                    exit(4);
+            }
+        } else {
+            ptr += (wr_rv / sizeof(char));
+            len -= ((wr_rv / sizeof(char)) * sizeof(char));
+        }
+    }
+}
+
+size_t sb_content_len(struct sharkybuf *sb) {
+    /*
+     * Length of the content of buffer sb, not counting any null bytes
+     * at the end of the buffer
+     *
+     * Asserts:
+     *      sb is not NULL
+     *      sb->addr is not NULL
+     */
+
+    char           *reader_ptr;
+    size_t          reader_len_remaining;
+
+    // Pre-flight checks
+    assert(sb != NULL);
+    assert(sb->addr != NULL);
+
+    // Setup
+    reader_ptr = sb->addr;
+    reader_len_remaining = sb->len;
+
+    // Adjust reader_len_remaining so that we don't write nulls to the terminal
+    for ( ; reader_len_remaining >= sizeof(char); ) {
+        if (reader_ptr[(reader_len_remaining/sizeof(char))-1] == '\0') {
+            reader_len_remaining -= sizeof(char);
+        } else {
+            break;
+        }
+    }
+
+    return reader_len_remaining;
+}
+
+void sb_buf_to_fd(struct sharkybuf *sb, int fd) {
+    /*
+     * Send content of buffer sb to fd using write(2), except for
+     * any null bytes at the end of the buffer
+     */
+    sb_write_all_(sb, fd, sb->addr, sb_content_len(sb), "[sb_buf_to_fd] write");
+}
+
+void sb_buf_to_stdout(struct sharkybuf *sb) {
+    /*
+     * Send content of buffer sb to stdout, see sb_buf_to_fd(...)
+     */
+    sb_buf_to_fd(sb, fileno(stdout));
+}
+
+void sb_frame_init(struct sharkybuf *sb) {
+    /*
+     * Start a frame in buffer sb: reserve room for a struct sb_frame_hdr at
+     * the start of the buffer and put the writer head just after it. Nothing
+     * is zeroed - the header, filled in by sb_frame_seal(...), says how
+     * many bytes of payload are valid.
+     *
+     * Asserts:
+     *      sb is not NULL
+     *      sb->addr is not NULL
+     *      sb->len is big enough for a header
+     */
+
+    // Pre-flight checks
+    assert(sb != NULL);
+    assert(sb->addr != NULL);
+    assert(sb->len > sizeof(struct sb_frame_hdr));
+
+    sb_dirty_extent_(sb);
+
+    sb->framed = true;
+    sb->frame_record_ct = 0;
+    sb->dirty = false;
+
+    // Initialize "writer head" position
+    sb->writer_ptr = (char*)(sb->addr) + sizeof(struct sb_frame_hdr);
+    sb->writer_len_remaining = sb->len - sizeof(struct sb_frame_hdr);
+}
+
+void sb_frame_seal(struct sharkybuf *sb) {
+    /*
+     * Fill in the frame header of buffer sb with the payload length and
+     * record count written so far
+     *
+     * Asserts:
+     *      sb is not NULL
+     *      sb is framed
+     */
+    struct sb_frame_hdr    *hdr;
+
+    // Pre-flight checks
+    assert(sb != NULL);
+    assert(sb->framed);
+
+    hdr = (struct sb_frame_hdr*)(sb->addr);
+    hdr->magic = SHARKYBUF_FRAME_MAGIC;
+    hdr->payload_len = (uint32_t)(sb->len - sizeof(struct sb_frame_hdr) - sb->writer_len_remaining);
+    hdr->record_ct = sb->frame_record_ct;
+    hdr->reserved = 0;
+}
+
+void sb_frame_payload(struct sharkybuf *sb, char **payload_ptr, size_t *payload_len) {
+    /*
+     * Check the frame header at the start of received buffer sb, and
+     * return where its payload is and how long it is
+     *
+     * Asserts:
+     *      sb is not NULL
+     *      sb->addr is not NULL
+     *      payload_ptr and payload_len are not NULL
+     */
+    struct sb_frame_hdr    *hdr;
+    size_t                  received;
+
+    // Pre-flight checks
+    assert(sb != NULL);
+    assert(sb->addr != NULL);
+    assert(payload_ptr != NULL);
+    assert(payload_len != NULL);
+
+    received = sb->len - sb->writer_len_remaining;
+    hdr = (struct sb_frame_hdr*)(sb->addr);
+
+    if (received < sizeof(struct sb_frame_hdr) ||
+        hdr->magic != SHARKYBUF_FRAME_MAGIC ||
+        hdr->payload_len > (received - sizeof(struct sb_frame_hdr))) {
+        fprintf(stderr, "[sb_frame_payload] bad frame (received %zu bytes).\n", received);
+        exit(4);
+    }
+
+    *payload_ptr = (char*)(sb->addr) + sizeof(struct sb_frame_hdr);
+    *payload_len = hdr->payload_len;
+}
+
+void sb_frame_payload_to_fd(struct sharkybuf *sb, int fd) {
+    /*
+     * Send the payload of the frame in received buffer sb to fd using
+     * write(2). No scanning for padding, the header says how much to send.
+     */
+    char           *payload_ptr;
+    size_t          payload_len;
+
+    sb_frame_payload(sb, &payload_ptr, &payload_len);
+    sb_write_all_(sb, fd, payload_ptr, payload_len, "[sb_frame_payload_to_fd] write");
+}
+
+static void sb_copy_fd_(int in_fd, int out_fd, size_t len, const char *who) {
+    /*
+     * Copy len bytes from in_fd to out_fd through a small bounce buffer,
+     * or just read and drop them if out_fd is -1. For when splice(2)
+     * won't do.
+     */
+    char            bounce[SHARKYBUF_BOUNCE_LEN];
+    ssize_t         rd_rv;
+    int             tries = 0;
+
+    while (len > 0) {
+        SB_STAT_TIMER(t);
+
+        rd_rv = read(in_fd, bounce, (len < sizeof(bounce)) ? len : sizeof(bounce));
+        SB_STAT_IO(NULL, t, rd_rv, (len < sizeof(bounce)) ? len : sizeof(bounce), bytes_in);
+
+        if (rd_rv < 0) {
+            if (errno == EAGAIN) sb_wait_(NULL, in_fd, -1, &tries);
+            if (errno == EINTR || errno == EAGAIN) continue;
+            perror(who);
+            exit(4);
+        } else if (rd_rv == 0) {
+            fprintf(stderr, "%s: unexpected EOF mid-frame.\n", who);
+            exit(4);
+        }
+
+        if (out_fd != -1)
+            sb_write_all_(NULL, out_fd, bounce, (size_t)rd_rv, who);
+
+        len -= (size_t)rd_rv;
+    }
+}
+
+static void sb_splice_all_(int in_fd, int out_fd, size_t len, bool *can_splice, const char *who) {
+    /*
+     * Move len bytes from pipe in_fd to out_fd with splice(2), so they
+     * never pass through userspace. If out_fd turns out not to support
+     * it (EINVAL, e.g. opened O_APPEND), clear *can_splice and copy the
+     * rest the slow way.
+     */
+    ssize_t         sp_rv;
+    int             tries = 0;
+
+    while (len > 0 && *can_splice) {
+        SB_STAT_TIMER(t);
+
+        sp_rv = splice(in_fd, NULL, out_fd, NULL, len, SPLICE_F_MOVE | SPLICE_F_MORE);
+        SB_STAT_IO(NULL, t, sp_rv, len, bytes_in);
+        if (sp_rv > 0) SB_STAT(NULL, bytes_out, (unsigned long long)sp_rv);
+
+        if (sp_rv < 0) {
+            switch (errno) {
+                case EINTR:
+                    // Try again
+                    continue;
+                case EAGAIN:
+                    // Try again, once there's something to move and room for it
+                    sb_wait_(NULL, in_fd, out_fd, &tries);
+                    continue;
+                case EINVAL:
+                    *can_splice = false;
+                    break;
+                default:
+                    perror(who);
+                    exit(4);
+            }
+        } else if (sp_rv == 0) {
+            fprintf(stderr, "%s: unexpected EOF mid-frame.\n", who);
+            exit(4);
+        } else {
+            len -= (size_t)sp_rv;
+        }
+    }
+
+    if (len > 0)
+        sb_copy_fd_(in_fd, out_fd, len, who);
+}
+
+void sb_splice_frames_to_fd(int fd, int out_fd, size_t frame_len) {
+    /*
+     * Pass framed buffers of frame_len bytes from pipe fd through to out_fd
+     * until EOF, without copying them into userspace: only each frame's
+     * header is read, then its payload is spliced to out_fd and the rest
+     * of the frame is spliced to /dev/null.
+     *
+     * Asserts:
+     *      frame_len is big enough for a header
+     */
+    struct sb_frame_hdr     hdr;
+    size_t                  hdr_got;
+    ssize_t                 rd_rv;
+    int                     null_fd;
+    bool                    can_splice_out = true;
+    bool                    can_splice_null = true;
+    int                     tries = 0;
+
+    // Pre-flight checks
+    assert(frame_len > sizeof(struct sb_frame_hdr));
+
+    null_fd = open("/dev/null", O_WRONLY);
+
+    if (null_fd == -1) {
+        perror("[sb_splice_frames_to_fd] open");
+        exit(4);
+    }
+
+    while (true) {
+        // Read frame header
+        for (hdr_got = 0; hdr_got < sizeof(hdr); ) {
+            SB_STAT_TIMER(t);
+
+            rd_rv = read(fd, (char*)&hdr + hdr_got, sizeof(hdr) - hdr_got);
+            SB_STAT_IO(NULL, t, rd_rv, sizeof(hdr) - hdr_got, bytes_in);
+
+            if (rd_rv < 0) {
+                if (errno == EAGAIN) sb_wait_(NULL, fd, -1, &tries);
+                if (errno == EINTR || errno == EAGAIN) continue;
+                perror("[sb_splice_frames_to_fd] read");
+                exit(4);
+            } else if (rd_rv == 0) {
+                break;
+            }
+
+            hdr_got += (size_t)rd_rv;
+        }
+
+        // Did we reach EOF?
+        if (hdr_got == 0) break;
+
+        if (hdr_got < sizeof(hdr) ||
+            hdr.magic != SHARKYBUF_FRAME_MAGIC ||
+            hdr.payload_len > (frame_len - sizeof(hdr))) {
+            fprintf(stderr, "[sb_splice_frames_to_fd] bad frame header.\n");
+            exit(4);
+        }
+
+        // Payload to out_fd, padding to /dev/null
+        sb_splice_all_(fd, out_fd, hdr.payload_len, &can_splice_out, "[sb_splice_frames_to_fd] splice");
+        sb_splice_all_(fd, null_fd, frame_len - sizeof(hdr) - hdr.payload_len, &can_splice_null,
+                       "[sb_splice_frames_to_fd] splice");
+    }
+
+    close(null_fd);
+}
+
+void sb_tee_fanout(int in_fd, int tee_fd, int out_fd) {
+    /*
+     * Fan the stream in pipe in_fd out to pipes tee_fd and out_fd until
+     * EOF, without copying it: whatever is in in_fd is duplicated into
+     * tee_fd with tee(2), then the same bytes are spliced on to out_fd.
+     * Each branch has its own pipe, so a slow reader only holds the other
+     * branch up once its own pipe is full. For more branches, chain
+     * fan-outs through intermediate pipes.
+     */
+    ssize_t         tee_rv;
+    bool            can_splice = true;
+    int             tries = 0;
+
+    while (true) {
+        SB_STAT_TIMER(t);
+
+        // As much as in_fd holds - tee(2) never waits for more
+        tee_rv = tee(in_fd, tee_fd, (size_t)1 << 30, 0);
+        SB_STAT_IO(NULL, t, tee_rv, 0, bytes_out);
+
+        if (tee_rv < 0) {
+            switch (errno) {
+                case EINTR:
+                    // Try again
+                    continue;
+                case EAGAIN:
+                    // Try again, once there's something to duplicate and room for it
+                    sb_wait_(NULL, in_fd, tee_fd, &tries);
+                    continue;
+                default:
+                    perror("[sb_tee_fanout] tee");
+                    exit(4);
+            }
+        }
+
+        // Did we reach EOF?
+        if (tee_rv == 0) break;
+
+        // Consume exactly what was duplicated, so the branches stay in step
+        sb_splice_all_(in_fd, out_fd, (size_t)tee_rv, &can_splice, "[sb_tee_fanout] splice");
+    }
+}
+
+static struct sb_pool_slab *sb_pool_slab_map_(size_t len) {
+    /*
+     * Map and pre-fault a new slab
+     */
+    struct sb_pool_slab    *slab;
+
+    slab = malloc(sizeof(struct sb_pool_slab));
+
+    if (slab == NULL) {
+        perror("[sb_pool_slab_map_] malloc");
+        exit(4);
+    }
+
+    sb_mem_charge_(SHARKYBUF_STRATEGY_POOL, len);
+    slab->addr = mmap(0, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+
+    if (slab->addr == MAP_FAILED) {
+        perror("[sb_pool_slab_map_] mmap");
+        exit(4);
+    }
+
+    SB_STAT(NULL, pages_alloc, sb_pages_(len));
+
+    slab->len = len;
+    slab->handed_out = 0;
+    slab->released = 0;
+    slab->next = NULL;
+
+    return slab;
+}
+
+static void sb_pool_slab_unmap_(struct sb_pool_slab *slab) {
+    if (munmap(slab->addr, slab->len) == -1) {
+        perror("[sb_pool_slab_unmap_] munmap");
+        exit(4);
+    }
+
+    SB_STAT(NULL, pages_freed, sb_pages_(slab->len));
+    sb_mem_uncharge_(SHARKYBUF_STRATEGY_POOL, slab->len);
+
+    free(slab);
+}
+
+static void sb_pool_release_(struct sb_pool *pool, struct sb_pool_slab *slab, size_t len) {
+    /*
+     * Account for len bytes of slab no longer being in use, and retire
+     * the slab once all of it has been handed out and released. The count
+     * goes one past slab->len, as the pool itself holds on to the slab
+     * for as long as it's the current one.
+     */
+    if (__atomic_add_fetch(&(slab->released), len, __ATOMIC_ACQ_REL) != (slab->len + 1))
+        return;
+
+    pthread_mutex_lock(&(pool->lock));
+    slab->next = pool->retired;
+    pool->retired = slab;
+    pthread_cond_broadcast(&(pool->cond));
+    pthread_mutex_unlock(&(pool->lock));
+
+    // It's now the pool shrinker's to unmap, if anyone is short of memory
+    sb_mem_wake_();
+}
+
+static size_t sb_pool_unmap_retired_(struct sb_pool_slab *slab) {
+    /*
+     * Unmap a list of retired slabs, which were pending release since
+     * they stopped being current
+     *
+     * Returns:
+     *      number of bytes unmapped
+     */
+    struct sb_pool_slab    *next;
+    size_t                  freed = 0;
+
+    for ( ; slab != NULL; slab = next) {
+        next = slab->next;
+        freed += slab->len;
+        sb_pool_slab_unmap_(slab);
+    }
+
+    if (freed > 0)
+        sb_mem_pending_sub_(freed);
+
+    return freed;
+}
+
+static void sb_pool_want_refill_(struct sb_pool *pool) {
+    /*
+     * The current slab is running low: ask the refill thread to prepare a
+     * spare slab, unless one is ready or already on its way
+     */
+    pthread_mutex_lock(&(pool->lock));
+    pool->cur_low = true;
+
+    if (pool->spare == NULL && !pool->refill_wanted) {
+        pool->refill_wanted = true;
+        pthread_cond_broadcast(&(pool->cond));
+    }
+
+    pthread_mutex_unlock(&(pool->lock));
+}
+
+static void sb_pool_next_slab_(struct sb_pool *pool) {
+    /*
+     * Retire the current slab and replace it with the spare, waiting for
+     * the refill thread only if it hasn't got one ready yet
+     */
+    struct sb_pool_slab    *old;
+
+    pthread_mutex_lock(&(pool->lock));
+
+    while (pool->spare == NULL) {
+        pool->refill_wanted = true;
+        pthread_cond_broadcast(&(pool->cond));
+        pthread_cond_wait(&(pool->cond), &(pool->lock));
+    }
+
+    old = pool->cur;
+    pool->cur = pool->spare;
+    pool->spare = NULL;
+    pool->cur_low = false;
+
+    // Until the old slab is unmapped, the threads holding buffers in it
+    // will be releasing it
+    sb_mem_pending_add_(old->len);
+
+    // Start on the next spare straight away - unless that would take us
+    // over the soft limit, then wait until the new slab runs low, by when
+    // the old one should have been released
+    if (!sb_mem_over_(pool->slab_len)) {
+        pool->refill_wanted = true;
+        pthread_cond_broadcast(&(pool->cond));
+    }
+
+    pthread_mutex_unlock(&(pool->lock));
+
+    // The unused tail of the old slab will never be handed out, so count
+    // it as released now, along with the pool's own hold on the slab
+    sb_pool_release_(pool, old, (old->len - old->handed_out) + 1);
+}
+
+static void *sb_pool_refill_thread_(void *arg) {
+    /*
+     * Background thread which maps and pre-faults spare slabs on request,
+     * and unmaps retired ones, keeping mmap/munmap off the hot path
+     */
+    struct sb_pool         *pool = arg;
+    struct sb_pool_slab    *retired, *slab;
+    bool                    need_spare;
+
+    pthread_mutex_lock(&(pool->lock));
+
+    while (true) {
+        while (!pool->shutdown && pool->retired == NULL &&
+               !(pool->refill_wanted && pool->spare == NULL))
+            pthread_cond_wait(&(pool->cond), &(pool->lock));
+
+        if (pool->shutdown) break;
+
+        retired = pool->retired;
+        pool->retired = NULL;
+        need_spare = (pool->refill_wanted && pool->spare == NULL);
+
+        pthread_mutex_unlock(&(pool->lock));
+
+        // Do the syscalls without holding the lock
+        sb_pool_unmap_retired_(retired);
+
+        slab = need_spare ? sb_pool_slab_map_(pool->slab_len) : NULL;
+
+        pthread_mutex_lock(&(pool->lock));
+
+        if (slab != NULL) {
+            pool->spare = slab;
+            pool->refill_wanted = false;
+            pthread_cond_broadcast(&(pool->cond));
+        }
+    }
+
+    pthread_mutex_unlock(&(pool->lock));
+    return NULL;
+}
+
+static size_t sb_pool_shrink_(void *arg) {
+    /*
+     * Shrinker for sb_mem_make_room_(...): unmap any retired slabs the
+     * refill thread hasn't got round to yet, and the pool's spare slab if
+     * it was only mapped ahead. A spare the current slab is running low
+     * on is kept, as it's about to be used, and dropping it would only
+     * leave the creating thread waiting for it to be mapped again.
+     *
+     * Returns:
+     *      number of bytes unmapped
+     */
+    struct sb_pool         *pool = arg;
+    struct sb_pool_slab    *retired, *spare = NULL;
+    size_t                  freed;
+
+    pthread_mutex_lock(&(pool->lock));
+    retired = pool->retired;
+    pool->retired = NULL;
+
+    if (pool->spare != NULL && !pool->cur_low) {
+        spare = pool->spare;
+        pool->spare = NULL;
+    }
+
+    pthread_mutex_unlock(&(pool->lock));
+
+    freed = sb_pool_unmap_retired_(retired);
+
+    if (spare != NULL) {
+        freed += spare->len;
+        sb_pool_slab_unmap_(spare);
+    }
+
+    return freed;
+}
+
+void sb_pool_init(struct sb_pool *pool, size_t slab_len) {
+    /*
+     * Set up a page pool handing out buffers from pre-faulted slabs of
+     * slab_len bytes, and start its refill thread
+     *
+     * Asserts:
+     *      pool is not NULL
+     *      slab_len is an exact multiple of system page size
+     */
+
+    // Pre-flight checks
+    assert(pool != NULL);
+    assert(slab_len > 0 && (slab_len % (size_t)sysconf(_SC_PAGESIZE)) == 0);
+
+    pool->slab_len = slab_len;
+    pool->low_water = slab_len / 4;
+
+    // First slab is mapped up front, the refill thread gets the spare ready
+    // if there's room for it under the soft limit
+    pool->cur = sb_pool_slab_map_(slab_len);
+    pool->spare = NULL;
+    pool->retired = NULL;
+    pool->refill_wanted = !sb_mem_over_(slab_len);
+    pool->cur_low = false;
+    pool->shutdown = false;
+
+    pthread_mutex_init(&(pool->lock), NULL);
+    pthread_cond_init(&(pool->cond), NULL);
+
+    if (pthread_create(&(pool->refill_thread), NULL, sb_pool_refill_thread_, pool) != 0) {
+        fprintf(stderr, "[sb_pool_init] pthread_create failed.\n");
+        exit(4);
+    }
+
+    sb_mem_shrinker_add(sb_pool_shrink_, pool);
+}
+
+void sb_pool_destroy(struct sb_pool *pool) {
+    /*
+     * Stop the refill thread and unmap every slab. All buffers created
+     * from the pool must have been disposed of first.
+     *
+     * Asserts:
+     *      pool is not NULL
+     */
+
+    // Pre-flight checks
+    assert(pool != NULL);
+
+    sb_mem_shrinker_remove(sb_pool_shrink_, pool);
+
+    pthread_mutex_lock(&(pool->lock));
+    pool->shutdown = true;
+    pthread_cond_broadcast(&(pool->cond));
+    pthread_mutex_unlock(&(pool->lock));
+
+    pthread_join(pool->refill_thread, NULL);
+
+    sb_pool_unmap_retired_(pool->retired);
+    pool->retired = NULL;
+
+    if (pool->spare != NULL)
+        sb_pool_slab_unmap_(pool->spare);
+
+    sb_pool_slab_unmap_(pool->cur);
+
+    pthread_mutex_destroy(&(pool->lock));
+    pthread_cond_destroy(&(pool->cond));
+
+    pool->cur = NULL;
+    pool->spare = NULL;
+}
+
+void sb_pagealloc_init(struct sb_pagealloc *pa, size_t page_len, uint32_t max_pages) {
+    /*
+     * Set up an allocator of up to max_pages pages of page_len bytes each.
+     * The address space for all of them is reserved up front with
+     * MAP_NORESERVE, and only costs memory as pages are first touched, so
+     * handing out a fresh page is one atomic add and pages never need to
+     * be unmapped until the allocator is destroyed.
+     *
+     * Asserts:
+     *      pa is not null
+     *      page_len is an exact multiple of system page size
+     *      0 < max_pages < SB_PAGECACHE_FRESH
+     */
+
+    // Pre-flight checks
+    assert(pa != NULL);
+    assert(page_len > 0 && (page_len % (size_t)sysconf(_SC_PAGESIZE)) == 0);
+    assert(max_pages > 0 && max_pages < SB_PAGECACHE_FRESH);
+
+    pa->base = mmap(0, page_len * max_pages, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+
+    if (pa->base == MAP_FAILED) {
+        perror("[sb_pagealloc_init] mmap");
+        exit(4);
+    }
+
+    pa->page_next = calloc(max_pages, sizeof(uint32_t));
+    pa->mag_next = calloc(max_pages, sizeof(uint32_t));
+    pa->mag_ct = calloc(max_pages, sizeof(uint32_t));
+
+    if (pa->page_next == NULL || pa->mag_next == NULL || pa->mag_ct == NULL) {
+        perror("[sb_pagealloc_init] calloc");
+        exit(4);
+    }
+
+    pa->page_len = page_len;
+    pa->max_pages = max_pages;
+    pa->bump = 0;
+    pa->depot = 0;
+}
+
+void sb_pagealloc_destroy(struct sb_pagealloc *pa) {
+    /*
+     * Unmap every page of allocator pa, whether or not it was given back
+     */
+    size_t      touched_len = pa->page_len * ((pa->bump < pa->max_pages) ? pa->bump : pa->max_pages);
+
+    SB_STAT(NULL, pages_freed, sb_pages_(touched_len));
+    sb_mem_uncharge_(SHARKYBUF_STRATEGY_PAGECACHE, touched_len);
+
+    if (munmap(pa->base, pa->page_len * pa->max_pages) == -1) {
+        perror("[sb_pagealloc_destroy] munmap");
+        exit(4);
+    }
+
+    free(pa->page_next);
+    free(pa->mag_next);
+    free(pa->mag_ct);
+    memset(pa, 0, sizeof(*pa));
+}
+
+static void sb_depot_push_(struct sb_pagealloc *pa, uint32_t first) {
+    /*
+     * Push the magazine starting at page first onto the depot. The tag in
+     * the top half of pa->depot changes with every push and pop, so a pop
+     * racing with a pop and push of the same magazine can't succeed (ABA).
+     */
+    uint64_t    old, new;
+
+    old = __atomic_load_n(&(pa->depot), __ATOMIC_RELAXED);
+
+    do {
+        __atomic_store_n(&(pa->mag_next[first]), (uint32_t)old, __ATOMIC_RELAXED);
+        new = (((old >> 32) + 1) << 32) | (uint64_t)(first + 1);
+    } while (!__atomic_compare_exchange_n(&(pa->depot), &old, new, true, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+static bool sb_depot_pop_(struct sb_pagealloc *pa, uint32_t *first) {
+    /*
+     * Pop a magazine off the depot, setting *first to its first page
+     *
+     * Returns:
+     *      true if there was one, false if the depot is empty
+     */
+    uint64_t    old, new;
+    uint32_t    top;
+
+    old = __atomic_load_n(&(pa->depot), __ATOMIC_ACQUIRE);
+
+    do {
+        if ((uint32_t)old == 0) return false;
+
+        // May be stale if someone else got here first - then the CAS fails
+        top = (uint32_t)old - 1;
+        new = (((old >> 32) + 1) << 32) | __atomic_load_n(&(pa->mag_next[top]), __ATOMIC_RELAXED);
+    } while (!__atomic_compare_exchange_n(&(pa->depot), &old, new, true, __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE));
+
+    *first = top;
+    return true;
+}
+
+static void sb_pagecache_refill_(struct sb_pagecache *pc) {
+    /*
+     * Fill empty cache pc with a magazine from the depot, or failing that
+     * with a batch of fresh pages
+     */
+    struct sb_pagealloc    *pa = pc->pa;
+    uint32_t                idx, first, ct;
+
+    if (sb_depot_pop_(pa, &idx)) {
+        for (ct = pa->mag_ct[idx]; ct > 0; ct--) {
+            pc->idx[pc->ct++] = idx;
+            idx = pa->page_next[idx] - 1;
+        }
+
+        return;
+    }
+
+    first = __atomic_fetch_add(&(pa->bump), SB_PAGECACHE_BATCH, __ATOMIC_RELAXED);
+
+    if (first >= pa->max_pages) {
+        fprintf(stderr, "[sb_pagecache_refill_] all %u pages in use.\n", pa->max_pages);
+        exit(4);
+    }
+
+    ct = (pa->max_pages - first < SB_PAGECACHE_BATCH) ? (pa->max_pages - first) : SB_PAGECACHE_BATCH;
+    SB_STAT(NULL, pages_alloc, sb_pages_(pa->page_len * ct));
+    sb_mem_charge_(SHARKYBUF_STRATEGY_PAGECACHE, pa->page_len * ct);
+
+    while (ct > 0)
+        pc->idx[pc->ct++] = (first + --ct) | SB_PAGECACHE_FRESH;
+}
+
+static void sb_pagecache_spill_(struct sb_pagecache *pc, uint32_t ct) {
+    /*
+     * Pass the last ct pages in cache pc to the depot as one magazine
+     */
+    struct sb_pagealloc    *pa = pc->pa;
+    uint32_t                first, idx;
+
+    first = pc->idx[pc->ct - ct] & ~SB_PAGECACHE_FRESH;
+    pa->mag_ct[first] = ct;
+
+    for (uint32_t i = pc->ct - ct + 1; i < pc->ct; i++) {
+        idx = pc->idx[i] & ~SB_PAGECACHE_FRESH;
+        pa->page_next[first] = idx + 1;
+        first = idx;
+    }
+
+    pa->page_next[first] = 0;
+    sb_depot_push_(pa, pc->idx[pc->ct - ct] & ~SB_PAGECACHE_FRESH);
+    pc->ct -= ct;
+}
+
+void sb_pagecache_init(struct sb_pagecache *pc, struct sb_pagealloc *pa) {
+    /*
+     * Set up an empty cache of pages from pa, for use by one thread only
+     */
+    pc->pa = pa;
+    pc->ct = 0;
+}
+
+void sb_pagecache_bind(struct sb_pagecache *pc) {
+    /*
+     * Make pc the calling thread's cache, for sb_dispose(...) of
+     * SHARKYBUF_STRATEGY_PAGECACHE buffers to give pages back to.
+     * NULL unbinds.
+     */
+    sb_pagecache_bound_ = pc;
+}
+
+void *sb_pagecache_get(struct sb_pagecache *pc, bool *fresh) {
+    /*
+     * Take a page from cache pc, refilling it from the depot (no locks,
+     * one CAS per magazine) or from fresh pages if it's empty. *fresh is
+     * set if the page has never been used, and so is still zero.
+     */
+    uint32_t    idx;
+
+    if (pc->ct == 0)
+        sb_pagecache_refill_(pc);
+
+    idx = pc->idx[--pc->ct];
+    *fresh = (idx & SB_PAGECACHE_FRESH) != 0;
+
+    return pc->pa->base + (size_t)(idx & ~SB_PAGECACHE_FRESH) * pc->pa->page_len;
+}
+
+void sb_pagecache_put(struct sb_pagecache *pc, void *page) {
+    /*
+     * Give page back to cache pc, passing a magazine's worth on to the
+     * depot if the cache is full - which is how pages freed by a consumer
+     * thread find their way back to producers
+     *
+     * Asserts:
+     *      page came from pc->pa
+     */
+    size_t      off = (size_t)((char*)page - pc->pa->base);
+
+    assert((char*)page >= pc->pa->base && (off % pc->pa->page_len) == 0);
+    assert((off / pc->pa->page_len) < pc->pa->max_pages);
+
+    if (pc->ct == SB_PAGECACHE_MAX)
+        sb_pagecache_spill_(pc, SB_PAGECACHE_BATCH);
+
+    pc->idx[pc->ct++] = (uint32_t)(off / pc->pa->page_len);
+}
+
+void sb_pagecache_flush(struct sb_pagecache *pc) {
+    /*
+     * Give every page in cache pc back to the depot, e.g. before its
+     * thread exits
+     */
+    while (pc->ct > 0)
+        sb_pagecache_spill_(pc, (pc->ct < SB_PAGECACHE_BATCH) ? pc->ct : SB_PAGECACHE_BATCH);
+}
+
+void sb_arena_init(struct sb_arena *a, size_t first_chunk_len, int backing) {
+    /*
+     * Set up an empty arena. Chunks are allocated as they're needed, the
+     * first one first_chunk_len bytes, each one after twice as big as the
+     * last, from malloc(3), mmap(2) or transparent huge pages according to
+     * backing (SB_ARENA_BACKING_*).
+     *
+     * Asserts:
+     *      a is not NULL
+     *      first_chunk_len > sizeof(struct sb_arena_chunk)
+     */
+
+    // Pre-flight checks
+    assert(a != NULL);
+    assert(first_chunk_len > sizeof(struct sb_arena_chunk));
+
+    switch (backing) {
+        case SB_ARENA_BACKING_MALLOC:
+        case SB_ARENA_BACKING_MMAP:
+        case SB_ARENA_BACKING_HUGEPAGE:
+            break;
+        default:
+            fprintf(stderr, "[sb_arena_init] invalid backing %d.\n", backing);
+            abort();
+    }
+
+    // No point in chunks smaller than a huge page if that's what backs them
+    if (backing == SB_ARENA_BACKING_HUGEPAGE && first_chunk_len < SHARKYBUF_HUGEPAGE_LEN)
+        first_chunk_len = SHARKYBUF_HUGEPAGE_LEN;
+
+    a->backing = backing;
+    a->next_chunk_len = first_chunk_len;
+    a->cur = NULL;
+    a->chunk_ct = 0;
+}
+
+void *sb_arena_alloc_chunk_(struct sb_arena *a, size_t len, size_t align) {
+    /*
+     * Slow path of sb_arena_alloc(...): the current chunk is full (or there
+     * isn't one), so start a new one big enough for this allocation, and
+     * allocate from it. Whatever was left in the old chunk is abandoned.
+     *
+     * Asserts:
+     *      align is a power of two, no bigger than a page
+     */
+    struct sharkybuf        sb;
+    struct sb_arena_chunk  *chunk;
+    size_t                  chunk_len, page_size, round;
+
+    // Pre-flight checks
+    page_size = (size_t)sysconf(_SC_PAGESIZE);
+    assert(align > 0 && (align & (align - 1)) == 0 && align <= page_size);
+
+    // Work out chunk size - geometric, but never too small for this allocation
+    chunk_len = sizeof(struct sb_arena_chunk) + align + len;
+    if (chunk_len < a->next_chunk_len) chunk_len = a->next_chunk_len;
+
+    round = (a->backing == SB_ARENA_BACKING_HUGEPAGE) ? SHARKYBUF_HUGEPAGE_LEN : page_size;
+    chunk_len = (chunk_len + round - 1) / round * round;
+
+    switch (a->backing) {
+        case SB_ARENA_BACKING_MALLOC:
+            sb_create_malloc(&sb, chunk_len);
+            break;
+        case SB_ARENA_BACKING_MMAP:
+            sb_create_mmap(&sb, chunk_len);
+            break;
+        case SB_ARENA_BACKING_HUGEPAGE:
+            sb_create_mmap_huge(&sb, chunk_len);
+            break;
+        default:
+            fprintf(stderr, "[sb_arena_alloc_chunk_] invalid backing %d.\n", a->backing);
+            abort();
+    }
+
+    // Chunk header goes at the start of its own buffer
+    chunk = (struct sb_arena_chunk*)(sb.addr);
+    chunk->sb = sb;
+    chunk->sb.writer_ptr += sizeof(struct sb_arena_chunk);
+    chunk->sb.writer_len_remaining -= sizeof(struct sb_arena_chunk);
+    chunk->sb.dirty = true;
+    chunk->prev = a->cur;
+
+    a->cur = chunk;
+    a->chunk_ct++;
+
+    if (a->next_chunk_len < SB_ARENA_MAX_CHUNK_LEN)
+        a->next_chunk_len = (chunk_len < SB_ARENA_MAX_CHUNK_LEN / 2) ? chunk_len * 2 : SB_ARENA_MAX_CHUNK_LEN;
+
+    return sb_arena_alloc(a, len, align);
+}
+
+static void sb_arena_free_chunk_(struct sb_arena *a) {
+    /*
+     * Dispose of the newest chunk
+     */
+    struct sb_arena_chunk  *chunk = a->cur;
+    struct sharkybuf        sb;
+
+    // Copy out the chunk's sharkybuf first, as it lives inside the chunk
+    a->cur = chunk->prev;
+    a->chunk_ct--;
+    sb = chunk->sb;
+    sb_dispose(&sb);
+}
+
+void sb_arena_mark(struct sb_arena *a, struct sb_arena_mark *mark) {
+    /*
+     * Record the arena's current position, so that everything allocated
+     * after it can be freed at once by sb_arena_reset(...)
+     */
+    mark->chunk = a->cur;
+    mark->ptr = (a->cur != NULL) ? a->cur->sb.writer_ptr : NULL;
+}
+
+void sb_arena_reset(struct sb_arena *a, const struct sb_arena_mark *mark) {
+    /*
+     * Free everything allocated since mark was taken, disposing of any
+     * chunks started since then
+     *
+     * Asserts:
+     *      mark's chunk is still in the arena
+     */
+    struct sharkybuf       *sb;
+
+    while (a->cur != mark->chunk) {
+        assert(a->cur != NULL);
+        sb_arena_free_chunk_(a);
+    }
+
+    if (a->cur != NULL) {
+        sb = &(a->cur->sb);
+        sb_dirty_extent_(sb);
+        sb->writer_len_remaining += (size_t)(sb->writer_ptr - mark->ptr);
+        sb->writer_ptr = mark->ptr;
+    }
+}
+
+void sb_arena_destroy(struct sb_arena *a) {
+    /*
+     * Free everything in the arena, one chunk at a time. The arena can
+     * be used again afterwards, starting from the same chunk size it
+     * had reached.
+     */
+    while (a->cur != NULL)
+        sb_arena_free_chunk_(a);
+}
+
+static const char *sb_find_eol_scalar_(const char *p, const char *end) {
+    while (p < end && *p != '\n' && *p != '\0')
+        p++;
+
+    return p;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("sse2")))
+static const char *sb_find_eol_sse2_(const char *p, const char *end) {
+    /*
+     * Find the first '\n' or '\0' in [p, end), 16 bytes at a time
+     */
+    const __m128i   nl = _mm_set1_epi8('\n');
+    const __m128i   nul = _mm_setzero_si128();
+    __m128i         v;
+    int             mask;
+
+    for ( ; (end - p) >= 16; p += 16) {
+        v = _mm_loadu_si128((const __m128i*)p);
+        mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, nl), _mm_cmpeq_epi8(v, nul)));
+
+        if (mask != 0)
+            return p + __builtin_ctz((unsigned)mask);
+    }
+
+    return sb_find_eol_scalar_(p, end);
+}
+
+__attribute__((target("avx2")))
+static const char *sb_find_eol_avx2_(const char *p, const char *end) {
+    /*
+     * Find the first '\n' or '\0' in [p, end), 32 bytes at a time
+     */
+    const __m256i   nl = _mm256_set1_epi8('\n');
+    const __m256i   nul = _mm256_setzero_si256();
+    __m256i         v;
+    unsigned        mask;
+
+    for ( ; (end - p) >= 32; p += 32) {
+        v = _mm256_loadu_si256((const __m256i*)p);
+        mask = (unsigned)_mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(v, nl),
+                                                              _mm256_cmpeq_epi8(v, nul)));
+
+        if (mask != 0)
+            return p + __builtin_ctz(mask);
+    }
+
+    return sb_find_eol_sse2_(p, end);
+}
+#endif
+
+static const char *sb_find_eol_(const char *p, const char *end) {
+    /*
+     * Find the first '\n' or '\0' in [p, end), or end if there isn't one,
+     * using the widest vector instructions this CPU has - picked on first use
+     */
+    static const char *(*find)(const char*, const char*) = NULL;
+
+    if (find == NULL) {
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_cpu_init();
+
+        if (__builtin_cpu_supports("avx2"))
+            find = sb_find_eol_avx2_;
+        else if (__builtin_cpu_supports("sse2"))
+            find = sb_find_eol_sse2_;
+        else
+#endif
+            find = sb_find_eol_scalar_;
+    }
+
+    return find(p, end);
+}
+
+static void sb_line_iter_carry_(struct sb_line_iter *it, const char *ptr, size_t len) {
+    /*
+     * Append len bytes at ptr to the carried-over partial record
+     */
+    size_t          new_cap;
+
+    if (it->carry_len + len > it->carry_cap) {
+        new_cap = (it->carry_cap > 0) ? it->carry_cap : 64;
+        while (new_cap < it->carry_len + len)
+            new_cap *= 2;
+
+        it->carry = realloc(it->carry, new_cap);
+
+        if (it->carry == NULL) {
+            perror("[sb_line_iter_carry_] realloc");
+            exit(4);
+        }
+
+        it->carry_cap = new_cap;
+    }
+
+    memcpy(it->carry + it->carry_len, ptr, len);
+    it->carry_len += len;
+}
+
+void sb_line_iter_init(struct sb_line_iter *it) {
+    /*
+     * Set up an iterator over the newline-separated records in a series
+     * of buffers, fed in one at a time by sb_line_iter_feed(...)
+     *
+     * Asserts:
+     *      it is not NULL
+     */
+
+    // Pre-flight checks
+    assert(it != NULL);
+
+    memset(it, 0, sizeof(*it));
+}
+
+void sb_line_iter_feed(struct sb_line_iter *it, const char *ptr, size_t len) {
+    /*
+     * Start iterating over the len bytes at ptr, which carry on from the
+     * last buffer fed in. Any null byte ends the data in this buffer, as
+     * the rest is padding.
+     *
+     * Asserts:
+     *      the last buffer has been iterated over to the end
+     */
+
+    // Pre-flight checks
+    assert(it->ptr == it->end);
+
+    it->ptr = ptr;
+    it->end = ptr + len;
+}
+
+bool sb_line_iter_next(struct sb_line_iter *it, const char **rec, size_t *rec_len) {
+    /*
+     * Get the next record, without its newline. A record that runs off
+     * the end of the buffer is kept, and completed from the next buffer.
+     * *rec is valid until the next call, or until the buffer is reused.
+     *
+     * Returns:
+     *      true with *rec and *rec_len set, if there was a whole record
+     *      false once the buffer is used up
+     */
+    const char     *eol;
+
+    if (it->ptr == it->end) return false;
+
+    eol = sb_find_eol_(it->ptr, it->end);
+
+    if (eol == it->end || *eol == '\0') {
+        // No more whole records in this buffer - keep the start of the
+        // next one, and skip any padding
+        sb_line_iter_carry_(it, it->ptr, (size_t)(eol - it->ptr));
+        it->ptr = it->end;
+        return false;
+    }
+
+    if (it->carry_len > 0) {
+        // Finish off the record started in the last buffer
+        sb_line_iter_carry_(it, it->ptr, (size_t)(eol - it->ptr));
+        *rec = it->carry;
+        *rec_len = it->carry_len;
+        it->carry_len = 0;
+    } else {
+        *rec = it->ptr;
+        *rec_len = (size_t)(eol - it->ptr);
+    }
+
+    it->ptr = eol + 1;
+    return true;
+}
+
+bool sb_line_iter_finish(struct sb_line_iter *it, const char **rec, size_t *rec_len) {
+    /*
+     * At end of input, get any last record which had no newline after it
+     *
+     * Returns:
+     *      true with *rec and *rec_len set, if there was one
+     *      false otherwise
+     */
+    if (it->carry_len == 0) return false;
+
+    *rec = it->carry;
+    *rec_len = it->carry_len;
+    it->carry_len = 0;
+
+    return true;
+}
+
+void sb_line_iter_dispose(struct sb_line_iter *it) {
+    free(it->carry);
+    memset(it, 0, sizeof(*it));
+}
+
+static inline size_t sb_chain_link_len_(const struct sb_chain_link *l) {
+    return (size_t)(l->sb.writer_ptr - (char*)(l->sb.addr));
+}
+
+static void sb_chain_add_link_(struct sb_chain *ch) {
+    /*
+     * Put a link with an empty buffer on the end of chain ch, reusing a
+     * spare one if there is one
+     */
+    struct sb_chain_link   *l;
+
+    if (ch->spare != NULL) {
+        l = ch->spare;
+        ch->spare = l->next;
+    } else {
+        l = malloc(sizeof(struct sb_chain_link));
+
+        if (l == NULL) {
+            perror("[sb_chain_add_link_] malloc");
+            exit(4);
+        }
+
+        sb_create_mmap(&(l->sb), ch->page_len);
+    }
+
+    l->next = NULL;
+
+    if (ch->tail != NULL)
+        ch->tail->next = l;
+    else
+        ch->head = l;
+
+    ch->tail = l;
+    ch->link_ct++;
+}
+
+static void sb_chain_free_links_(struct sb_chain_link *l) {
+    struct sb_chain_link   *next;
+
+    for ( ; l != NULL; l = next) {
+        next = l->next;
+        sb_dispose(&(l->sb));
+        free(l);
+    }
+}
+
+static void sb_chain_send_(struct sb_chain *ch, int fd, bool gift, const char *who) {
+    /*
+     * Send the whole content of chain ch to fd, as many links per syscall
+     * as an iovec array of SHARKYBUF_MAX_IOV will take: writev(2), or
+     * vmsplice(... SPLICE_F_GIFT) if gift is set. Short transfers carry on
+     * from where they stopped. The links are left in place.
+     */
+    struct iovec            iov[SHARKYBUF_MAX_IOV];
+    struct sb_chain_link   *l, *m;
+    size_t                  off = 0;
+    size_t                  skip, avail, want, left;
+    ssize_t                 rv;
+    int                     iov_ct;
+    int                     tries = 0;
+
+    l = ch->head;
+
+    while (l != NULL) {
+        // Gather from the current position onwards
+        iov_ct = 0;
+        want = 0;
+
+        for (m = l; m != NULL && iov_ct < SHARKYBUF_MAX_IOV; m = m->next) {
+            skip = (m == l) ? off : 0;
+            avail = sb_chain_link_len_(m) - skip;
+
+            if (avail == 0) continue;
+
+            iov[iov_ct].iov_base = (char*)(m->sb.addr) + skip;
+            iov[iov_ct].iov_len = avail;
+            want += avail;
+            iov_ct++;
+        }
+
+        if (iov_ct == 0) break;
+
+        SB_STAT_TIMER(t);
+
+        if (gift)
+            rv = vmsplice(fd, iov, (unsigned long)iov_ct, SPLICE_F_GIFT);
+        else
+            rv = writev(fd, iov, iov_ct);
+
+        SB_STAT_IO(NULL, t, rv, want, bytes_out);
+
+        if (rv < 0) {
+            switch (errno) {
+                case EINTR:
+                    // Try again
+                    continue;
+                case EAGAIN:
+                    // Try again, once fd has room
+                    sb_wait_(NULL, -1, fd, &tries);
+                    continue;
+                default:
+                    perror(who);
+                    exit(4);
+            }
+        }
+
+        // Move the current position past what was sent
+        for (left = (size_t)rv; left > 0; ) {
+            avail = sb_chain_link_len_(l) - off;
+
+            if (left >= avail) {
+                left -= avail;
+                l = l->next;
+                off = 0;
+            } else {
+                off += left;
+                left = 0;
+            }
+        }
+    }
+}
+
+void sb_chain_init(struct sb_chain *ch, size_t page_len) {
+    /*
+     * Set up an empty chain, whose links will each hold page_len bytes.
+     * No memory is allocated until something is appended.
+     *
+     * Asserts:
+     *      ch is not NULL
+     *      page_len is an exact multiple of system page size
+     */
+
+    // Pre-flight checks
+    assert(ch != NULL);
+    assert(page_len > 0 && (page_len % (size_t)sysconf(_SC_PAGESIZE)) == 0);
+
+    ch->head = NULL;
+    ch->tail = NULL;
+    ch->spare = NULL;
+    ch->page_len = page_len;
+    ch->len = 0;
+    ch->link_ct = 0;
+}
+
+void sb_chain_append_bytes(struct sb_chain *ch, const void *src, size_t len) {
+    /*
+     * Append the len bytes at src to chain ch, filling up the last link
+     * and adding as many new ones as it takes. Always succeeds.
+     */
+    const char     *p = src;
+    size_t          unwritten;
+
+    while (len > 0) {
+        if (ch->tail == NULL || ch->tail->sb.writer_len_remaining == 0)
+            sb_chain_add_link_(ch);
+
+        unwritten = sb_append_bytes(&(ch->tail->sb), p, len);
+        p += len - unwritten;
+        ch->len += len - unwritten;
+        len = unwritten;
+    }
+}
+
+void sb_chain_append_record(struct sb_chain *ch, const char *rec, size_t len, char sep) {
+    /*
+     * Append the len bytes at rec, followed by sep unless sep is '\0', to
+     * chain ch. Unlike sb_append_record(...) a record may straddle two
+     * links - the chain is only ever sent as a whole.
+     */
+    sb_chain_append_bytes(ch, rec, len);
+
+    if (sep != '\0')
+        sb_chain_append_bytes(ch, &sep, 1);
+}
+
+void sb_chain_move(struct sb_chain *dst, struct sb_chain *src) {
+    /*
+     * Move the content of chain src onto the end of chain dst, by relinking
+     * rather than copying, leaving src empty. Appending to dst carries on
+     * in what was src's last link.
+     *
+     * Asserts:
+     *      dst and src are not NULL, and not the same chain
+     */
+
+    // Pre-flight checks
+    assert(dst != NULL && src != NULL);
+    assert(dst != src);
+
+    if (src->head == NULL) return;
+
+    if (dst->tail != NULL)
+        dst->tail->next = src->head;
+    else
+        dst->head = src->head;
+
+    dst->tail = src->tail;
+    dst->len += src->len;
+    dst->link_ct += src->link_ct;
+
+    src->head = NULL;
+    src->tail = NULL;
+    src->len = 0;
+    src->link_ct = 0;
+}
+
+void sb_chain_writev(struct sb_chain *ch, int fd) {
+    /*
+     * Write the whole content of chain ch to fd with writev(2), then empty
+     * the chain. Its links are kept to be appended to again.
+     */
+    struct sb_chain_link   *l;
+
+    sb_chain_send_(ch, fd, false, "[sb_chain_writev] writev");
+
+    for (l = ch->head; l != NULL; l = ch->head) {
+        ch->head = l->next;
+        sb_rewind(&(l->sb));
+        l->next = ch->spare;
+        ch->spare = l;
+    }
+
+    ch->tail = NULL;
+    ch->len = 0;
+    ch->link_ct = 0;
+}
+
+void sb_chain_vmsplice(struct sb_chain *ch, int fd) {
+    /*
+     * Give the whole content of chain ch to pipe fd with
+     * vmsplice(... SPLICE_F_GIFT), then empty the chain. As we mustn't
+     * touch gifted pages again, its links are disposed of rather than
+     * kept; spare links, never gifted, are kept.
+     */
+    sb_chain_send_(ch, fd, true, "[sb_chain_vmsplice] vmsplice");
+    sb_chain_free_links_(ch->head);
+
+    ch->head = NULL;
+    ch->tail = NULL;
+    ch->len = 0;
+    ch->link_ct = 0;
+}
+
+void sb_chain_dispose(struct sb_chain *ch) {
+    /*
+     * Throw away the content of chain ch, and all its links
+     */
+    sb_chain_free_links_(ch->head);
+    sb_chain_free_links_(ch->spare);
+
+    ch->head = NULL;
+    ch->tail = NULL;
+    ch->spare = NULL;
+    ch->len = 0;
+    ch->link_ct = 0;
+}
+
+void sb_chain_handoff_init(struct sb_chain_handoff *h) {
+    /*
+     * Set up an empty, open mailbox. Its chain is never appended to
+     * directly, only moved in and out of, so it has no page size.
+     */
+    pthread_mutex_init(&(h->lock), NULL);
+    pthread_cond_init(&(h->cond), NULL);
+
+    h->chain.head = NULL;
+    h->chain.tail = NULL;
+    h->chain.spare = NULL;
+    h->chain.page_len = 0;
+    h->chain.len = 0;
+    h->chain.link_ct = 0;
+    h->closed = false;
+}
+
+void sb_chain_handoff_post(struct sb_chain_handoff *h, struct sb_chain *ch) {
+    /*
+     * Move the content of chain ch into mailbox h, waking the consumer.
+     * ch is left empty, and can be appended to again straight away - into
+     * links the consumer has written out and given back, if they're the
+     * right size, so that links go round rather than being mapped afresh.
+     *
+     * Asserts:
+     *      h is not closed
+     */
+    struct sb_chain_link  **lp, *l;
+
+    pthread_mutex_lock(&(h->lock));
+    assert(!h->closed);
+
+    sb_chain_move(&(h->chain), ch);
+
+    for (lp = &(h->chain.spare); (l = *lp) != NULL; ) {
+        if (l->sb.len == ch->page_len) {
+            *lp = l->next;
+            l->next = ch->spare;
+            ch->spare = l;
         } else {
-            reader_ptr += (wr_rv / sizeof(char));
-            reader_len_remaining -= ((wr_rv / sizeof(char)) * sizeof(char));
+            lp = &(l->next);
+        }
+    }
+
+    pthread_cond_broadcast(&(h->cond));
+    pthread_mutex_unlock(&(h->lock));
+}
+
+int sb_chain_handoff_take(struct sb_chain_handoff *h, struct sb_chain *ch, bool wait) {
+    /*
+     * Move everything posted to mailbox h so far onto the end of chain ch,
+     * first waiting for something to be posted if wait is set. The spare
+     * links ch has been left with by writing out what it took last time
+     * are given back, for producers to pick up as they post.
+     *
+     * Returns:
+     *      0 if we took something
+     *      1 if h is closed and there is nothing left to take
+     *      2 if there was nothing to take (only if !wait)
+     */
+    struct sb_chain_link   *l;
+    int                     rv;
+
+    pthread_mutex_lock(&(h->lock));
+
+    while (ch->spare != NULL) {
+        l = ch->spare;
+        ch->spare = l->next;
+        l->next = h->chain.spare;
+        h->chain.spare = l;
+    }
+
+    while (wait && h->chain.head == NULL && !h->closed)
+        pthread_cond_wait(&(h->cond), &(h->lock));
+
+    if (h->chain.head != NULL) {
+        sb_chain_move(ch, &(h->chain));
+        rv = 0;
+    } else {
+        rv = h->closed ? 1 : 2;
+    }
+
+    pthread_mutex_unlock(&(h->lock));
+
+    return rv;
+}
+
+void sb_chain_handoff_close(struct sb_chain_handoff *h) {
+    /*
+     * No more will be posted to mailbox h - once the consumer has taken
+     * what's there, sb_chain_handoff_take(...) says so
+     */
+    pthread_mutex_lock(&(h->lock));
+    h->closed = true;
+    pthread_cond_broadcast(&(h->cond));
+    pthread_mutex_unlock(&(h->lock));
+}
+
+void sb_chain_handoff_destroy(struct sb_chain_handoff *h) {
+    /*
+     * Tear down mailbox h, throwing away anything never taken
+     */
+    sb_chain_dispose(&(h->chain));
+    pthread_cond_destroy(&(h->cond));
+    pthread_mutex_destroy(&(h->lock));
+}
+
+static void sb_direct_write_all_(struct sb_direct_sink *sink, const char *ptr, size_t len, uint64_t off) {
+    /*
+     * Write len bytes at ptr to the sink's file at offset off (or just
+     * append them, if it isn't seekable), retrying after short writes
+     */
+    ssize_t         wr_rv;
+    int             tries = 0;
+
+    while (len > 0) {
+        SB_STAT_TIMER(t);
+
+        if (sink->seekable)
+            wr_rv = pwrite(sink->fd, ptr, len, (off_t)off);
+        else
+            wr_rv = write(sink->fd, ptr, len);
+
+        SB_STAT_IO(NULL, t, wr_rv, len, bytes_out);
+
+        if (wr_rv < 0) {
+            switch (errno) {
+                case EINTR:
+                    // Try again
+                    continue;
+                case EAGAIN:
+                    // Try again, once fd has room
+                    sb_wait_(NULL, -1, sink->fd, &tries);
+                    continue;
+                default:
+                    perror("[sb_direct_write_all_] write");
+                    exit(4);
+            }
+        }
+
+        ptr += wr_rv;
+        len -= (size_t)wr_rv;
+        off += (uint64_t)wr_rv;
+    }
+}
+
+static void *sb_direct_writer_thread_(void *arg) {
+    /*
+     * Write out each buffer handed over by sb_direct_submit_(...), until
+     * told to shut down
+     */
+    struct sb_direct_sink  *sink = arg;
+    int                     idx;
+
+    pthread_mutex_lock(&(sink->lock));
+
+    while (true) {
+        while (sink->inflight == -1 && !sink->shutdown)
+            pthread_cond_wait(&(sink->cond), &(sink->lock));
+
+        if (sink->inflight == -1) break;
+
+        // Write without holding the lock - the filling side only waits
+        // for us once it has filled its own buffer
+        idx = sink->inflight;
+        pthread_mutex_unlock(&(sink->lock));
+
+        sb_direct_write_all_(sink, sink->bufs[idx].addr, sink->inflight_len, sink->inflight_off);
+
+        pthread_mutex_lock(&(sink->lock));
+        sink->inflight = -1;
+        pthread_cond_broadcast(&(sink->cond));
+    }
+
+    pthread_mutex_unlock(&(sink->lock));
+
+    return NULL;
+}
+
+static void sb_direct_wait_idle_(struct sb_direct_sink *sink) {
+    pthread_mutex_lock(&(sink->lock));
+
+    while (sink->inflight != -1)
+        pthread_cond_wait(&(sink->cond), &(sink->lock));
+
+    pthread_mutex_unlock(&(sink->lock));
+}
+
+static void sb_direct_submit_(struct sb_direct_sink *sink, size_t len) {
+    /*
+     * Hand the first len bytes of the filling buffer to the writer thread,
+     * and carry on filling the other one once the writer is done with it
+     */
+    sb_direct_wait_idle_(sink);
+
+    pthread_mutex_lock(&(sink->lock));
+    sink->inflight = sink->fill;
+    sink->inflight_len = len;
+    sink->inflight_off = sink->fill_off;
+    pthread_cond_broadcast(&(sink->cond));
+    pthread_mutex_unlock(&(sink->lock));
+
+    sink->fill ^= 1;
+    sink->fill_off += len;
+    sb_rewind(&(sink->bufs[sink->fill]));
+}
+
+void sb_direct_open(struct sb_direct_sink *sink, const char *path, size_t buf_len) {
+    /*
+     * Create or truncate the file at path, and set up sink to write to it
+     * with O_DIRECT, so that big outputs don't push everything else (our
+     * dictionary mapping, say) out of the page cache. If the file system
+     * won't do O_DIRECT, or path isn't a regular file, the sink still
+     * works, just with ordinary writes.
+     *
+     * Asserts:
+     *      sink is not null
+     *      path is not null
+     *      buf_len is an exact multiple of system page size and of
+     *      SHARKYBUF_DIRECT_ALIGN
+     */
+    struct stat     st;
+    int             flags;
+
+    // Pre-flight checks
+    assert(sink != NULL);
+    assert(path != NULL);
+    assert(buf_len > 0 && (buf_len % (size_t)sysconf(_SC_PAGESIZE)) == 0);
+    assert((buf_len % SHARKYBUF_DIRECT_ALIGN) == 0);
+
+    sink->direct = true;
+    sink->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT, 0644);
+
+    if (sink->fd == -1 && errno == EINVAL) {
+        sink->direct = false;
+        sink->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    }
+
+    if (sink->fd == -1) {
+        perror(path);
+        exit(4);
+    }
+
+    if (fstat(sink->fd, &st) == -1) {
+        perror("[sb_direct_open] fstat");
+        exit(4);
+    }
+
+    sink->seekable = S_ISREG(st.st_mode);
+
+    // O_DIRECT only makes sense for regular files - drop it for anything else
+    if (sink->direct && !sink->seekable) {
+        sink->direct = false;
+        flags = fcntl(sink->fd, F_GETFL);
+
+        if (flags == -1 || fcntl(sink->fd, F_SETFL, flags & ~O_DIRECT) == -1) {
+            perror("[sb_direct_open] fcntl");
+            exit(4);
+        }
+    }
+
+    // Page-aligned, so fine for O_DIRECT
+    sb_create_posix_memalign(&(sink->bufs[0]), buf_len);
+    sb_create_posix_memalign(&(sink->bufs[1]), buf_len);
+    sink->fill = 0;
+    sink->fill_off = 0;
+
+    pthread_mutex_init(&(sink->lock), NULL);
+    pthread_cond_init(&(sink->cond), NULL);
+    sink->inflight = -1;
+    sink->inflight_len = 0;
+    sink->inflight_off = 0;
+    sink->shutdown = false;
+
+    if (pthread_create(&(sink->writer_thread), NULL, sb_direct_writer_thread_, sink) != 0) {
+        fprintf(stderr, "[sb_direct_open] pthread_create failed.\n");
+        exit(4);
+    }
+}
+
+void sb_direct_write(struct sb_direct_sink *sink, const void *src, size_t len) {
+    /*
+     * Copy len bytes at src into the sink, handing each buffer to the
+     * writer thread as it fills up
+     */
+    const char         *p = src;
+    struct sharkybuf   *sb;
+    size_t              unwritten;
+
+    while (len > 0) {
+        sb = &(sink->bufs[sink->fill]);
+        unwritten = sb_append_bytes(sb, p, len);
+        p += len - unwritten;
+        len = unwritten;
+
+        if (sb->writer_len_remaining == 0)
+            sb_direct_submit_(sink, sb->len);
+    }
+}
+
+void sb_direct_close(struct sb_direct_sink *sink) {
+    /*
+     * Write out whatever is left in the sink and close its file. With
+     * O_DIRECT, a final part-block tail can't be written as it is: it is
+     * padded with zeroes to a whole block, written, and the file then
+     * truncated back to its true length.
+     */
+    struct sharkybuf   *sb = &(sink->bufs[sink->fill]);
+    size_t              tail_len, padded_len;
+
+    tail_len = (size_t)(sb->writer_ptr - (char*)(sb->addr));
+
+    // The other buffer has to be out before the tail, or the truncate
+    // could race with it
+    sb_direct_wait_idle_(sink);
+
+    if (tail_len > 0 && sink->direct) {
+        padded_len = (tail_len + SHARKYBUF_DIRECT_ALIGN - 1) & ~(size_t)(SHARKYBUF_DIRECT_ALIGN - 1);
+        memset(sb->writer_ptr, 0, padded_len - tail_len);
+        sb_direct_write_all_(sink, sb->addr, padded_len, sink->fill_off);
+
+        if (ftruncate(sink->fd, (off_t)(sink->fill_off + tail_len)) == -1) {
+            perror("[sb_direct_close] ftruncate");
+            exit(4);
+        }
+    } else if (tail_len > 0) {
+        sb_direct_write_all_(sink, sb->addr, tail_len, sink->fill_off);
+    }
+
+    // Stop the writer thread
+    pthread_mutex_lock(&(sink->lock));
+    sink->shutdown = true;
+    pthread_cond_broadcast(&(sink->cond));
+    pthread_mutex_unlock(&(sink->lock));
+
+    pthread_join(sink->writer_thread, NULL);
+    pthread_cond_destroy(&(sink->cond));
+    pthread_mutex_destroy(&(sink->lock));
+
+    if (close(sink->fd) == -1) {
+        perror("[sb_direct_close] close");
+        exit(4);
+    }
+
+    sb_dispose(&(sink->bufs[0]));
+    sb_dispose(&(sink->bufs[1]));
+    sink->fd = -1;
+}
+
+void sb_mem_set_limit(size_t limit) {
+    /*
+     * Set a soft limit of limit bytes, or none if 0, on the memory held by
+     * sharkybufs in this process. An allocation that would go over it first
+     * has the registered shrinkers (e.g. one per sb_pool) give back what
+     * they can. If other threads are still to release memory they no longer
+     * use, it then waits for them, up to SHARKYBUF_MEM_WAIT_MS; otherwise,
+     * or after that, it goes ahead anyway.
+     */
+    __atomic_store_n(&(sb_mem_.limit), (unsigned long long)limit, __ATOMIC_RELAXED);
+
+    // Let waiters see a raised limit
+    sb_mem_wake_();
+}
+
+void sb_mem_usage(struct sb_mem_usage *u) {
+    /*
+     * Take a snapshot of the memory accounting - each counter is read
+     * atomically, but not all at the same instant
+     */
+    for (int i = 0; i < SHARKYBUF_STRATEGY_CT; i++)
+        u->live[i] = __atomic_load_n(&(sb_mem_.live[i]), __ATOMIC_RELAXED);
+
+    u->live_total = __atomic_load_n(&(sb_mem_.live_total), __ATOMIC_RELAXED);
+    u->peak_total = __atomic_load_n(&(sb_mem_.peak_total), __ATOMIC_RELAXED);
+    u->limit = __atomic_load_n(&(sb_mem_.limit), __ATOMIC_RELAXED);
+    u->pending = __atomic_load_n(&(sb_mem_.pending), __ATOMIC_RELAXED);
+    u->shrunk = __atomic_load_n(&(sb_mem_.shrunk), __ATOMIC_RELAXED);
+    u->wait_ct = __atomic_load_n(&(sb_mem_.wait_ct), __ATOMIC_RELAXED);
+    u->wait_ns = __atomic_load_n(&(sb_mem_.wait_ns), __ATOMIC_RELAXED);
+    u->over_ct = __atomic_load_n(&(sb_mem_.over_ct), __ATOMIC_RELAXED);
+}
+
+void sb_mem_shrinker_add(size_t (*fn)(void *arg), void *arg) {
+    /*
+     * Register fn, to be called with arg when an allocation would go over
+     * the soft limit. It should give back whatever memory it can spare,
+     * and return how many bytes that was. It must not allocate buffers.
+     */
+    pthread_mutex_lock(&sb_mem_shrink_lock_);
+
+    if (sb_mem_shrinker_ct_ == SHARKYBUF_MEM_MAX_SHRINKERS) {
+        fprintf(stderr, "[sb_mem_shrinker_add] too many shrinkers.\n");
+        exit(4);
+    }
+
+    sb_mem_shrinkers_[sb_mem_shrinker_ct_].fn = fn;
+    sb_mem_shrinkers_[sb_mem_shrinker_ct_].arg = arg;
+    sb_mem_shrinker_ct_++;
+
+    pthread_mutex_unlock(&sb_mem_shrink_lock_);
+}
+
+void sb_mem_shrinker_remove(size_t (*fn)(void *arg), void *arg) {
+    /*
+     * Unregister fn with arg, waiting for it to finish if it's running.
+     * Does nothing if it isn't registered.
+     */
+    pthread_mutex_lock(&sb_mem_shrink_lock_);
+
+    for (int i = 0; i < sb_mem_shrinker_ct_; i++) {
+        if (sb_mem_shrinkers_[i].fn == fn && sb_mem_shrinkers_[i].arg == arg) {
+            sb_mem_shrinkers_[i] = sb_mem_shrinkers_[--sb_mem_shrinker_ct_];
+            break;
         }
     }
+
+    pthread_mutex_unlock(&sb_mem_shrink_lock_);
+}
+
+void sb_mem_dump(int fd, const char *who) {
+    /*
+     * Write a one-line summary of the memory accounting, labelled who, to
+     * fd, in KiB. Like sb_stats_dump(...), safe to call from a signal
+     * handler.
+     */
+    static const char * const   names[SHARKYBUF_STRATEGY_CT] = {
+        NULL, "mmap", "posix_memalign", "malloc", NULL, "pool", "filemap", "pagecache"
+    };
+    char                line[512];
+    struct sharkybuf    sb;
+    struct sb_mem_usage u;
+    size_t              unwritten = 0;
+
+    sb_mem_usage(&u);
+    sb_create_external(&sb, line, sizeof(line));
+
+#define SB_MEM_STR_(str)       unwritten += sb_append_record(&sb, (str), strlen(str), '\0')
+#define SB_MEM_KIB_(v)         unwritten += sb_append_u64(&sb, (v) / 1024, '\0')
+    SB_MEM_STR_("-DD- sharkybuf memory (");
+    SB_MEM_STR_(who);
+    SB_MEM_STR_("): ");
+    SB_MEM_KIB_(u.live_total);
+    SB_MEM_STR_(" KiB live (");
+
+    for (int i = 0, first = 1; i < SHARKYBUF_STRATEGY_CT; i++) {
+        if (names[i] == NULL) continue;
+        if (!first) SB_MEM_STR_(", ");
+        first = 0;
+        SB_MEM_STR_(names[i]);
+        SB_MEM_STR_(" ");
+        SB_MEM_KIB_(u.live[i]);
+    }
+
+    SB_MEM_STR_("), ");
+    SB_MEM_KIB_(u.peak_total);
+    SB_MEM_STR_(" KiB peak, ");
+    SB_MEM_KIB_(u.limit);
+    SB_MEM_STR_(" KiB limit (");
+    SB_MEM_KIB_(u.pending);
+    SB_MEM_STR_(" KiB pending, ");
+    SB_MEM_KIB_(u.shrunk);
+    SB_MEM_STR_(" KiB shrunk, ");
+    unwritten += sb_append_u64(&sb, u.wait_ct, '\0');
+    SB_MEM_STR_(" waits for ");
+    unwritten += sb_append_u64(&sb, u.wait_ns / 1000, '\0');
+    SB_MEM_STR_(" us, ");
+    unwritten += sb_append_u64(&sb, u.over_ct, '\0');
+    SB_MEM_STR_(" over).\n");
+#undef SB_MEM_STR_
+#undef SB_MEM_KIB_
+
+    if (unwritten > 0) {
+        static const char   too_long[] = "-DD- sharkybuf memory: label too long.\n";
+
+        sb_rewind(&sb);
+        sb_append_record(&sb, too_long, sizeof(too_long) - 1, '\0');
+    }
+
+    // Best effort - there's nobody to complain to if this fails
+    (void)!write(fd, sb.addr, (size_t)(sb.writer_ptr - (char*)(sb.addr)));
+}
+
+void sb_stats_dump(int fd, const char *who, const struct sb_stats *st) {
+    /*
+     * Write a one-line summary of counters st, labelled who, to fd. Only
+     * uses write(2) and no stdio, so that it can be called from a signal
+     * handler.
+     */
+    char                line[512];
+    struct sharkybuf    sb;
+    size_t              unwritten = 0;
+
+    sb_create_external(&sb, line, sizeof(line));
+
+#define SB_STATS_STR_(str)     unwritten += sb_append_record(&sb, (str), strlen(str), '\0')
+#define SB_STATS_U64_(v)       unwritten += sb_append_u64(&sb, (v), '\0')
+    SB_STATS_STR_("-DD- sharkybuf stats (");
+    SB_STATS_STR_(who);
+    SB_STATS_STR_("): ");
+    SB_STATS_U64_(st->bytes_in);
+    SB_STATS_STR_(" bytes in, ");
+    SB_STATS_U64_(st->bytes_out);
+    SB_STATS_STR_(" bytes out, ");
+    SB_STATS_U64_(st->syscall_ct);
+    SB_STATS_STR_(" syscalls (");
+    SB_STATS_U64_(st->short_ct);
+    SB_STATS_STR_(" short, ");
+    SB_STATS_U64_(st->eintr_ct);
+    SB_STATS_STR_(" EINTR, ");
+    SB_STATS_U64_(st->eagain_ct);
+    SB_STATS_STR_(" EAGAIN: ");
+    SB_STATS_U64_(st->spin_ct);
+    SB_STATS_STR_(" spins, ");
+    SB_STATS_U64_(st->poll_ct);
+    SB_STATS_STR_(" polls), ");
+    SB_STATS_U64_(st->blocked_ns / 1000);
+    SB_STATS_STR_(" us blocked, ");
+    SB_STATS_U64_(st->pages_alloc);
+    SB_STATS_STR_(" pages allocated, ");
+    SB_STATS_U64_(st->pages_freed);
+    SB_STATS_STR_(" freed.\n");
+#undef SB_STATS_STR_
+#undef SB_STATS_U64_
+
+    // Can only happen with a silly long who - say so rather than truncate
+    if (unwritten > 0) {
+        static const char   too_long[] = "-DD- sharkybuf stats: label too long.\n";
+
+        sb_rewind(&sb);
+        sb_append_record(&sb, too_long, sizeof(too_long) - 1, '\0');
+    }
+
+    // Best effort - there's nobody to complain to if this fails
+    (void)!write(fd, sb.addr, (size_t)(sb.writer_ptr - (char*)(sb.addr)));
+}
+
+#ifdef SHARKYBUF_STATS
+static const char *sb_stats_who_;
+
+static void sb_stats_dump_global_(void) {
+    sb_stats_dump(STDERR_FILENO, sb_stats_who_, &sb_stats_global);
+    sb_mem_dump(STDERR_FILENO, sb_stats_who_);
+}
+
+static void sb_stats_sigusr1_(int signo) {
+    int         saved_errno = errno;
+
+    (void)signo;
+    sb_stats_dump_global_();
+    errno = saved_errno;
+}
+#endif
+
+void sb_stats_install(const char *who) {
+    /*
+     * Arrange for the process-wide counters to be dumped to stderr,
+     * labelled who, at exit(3) and whenever we get SIGUSR1, along with the
+     * memory accounting. Does nothing unless built with -DSHARKYBUF_STATS.
+     * Call again in a fork(2) child to relabel it and start its counts
+     * afresh, so that it doesn't report what its parent did; the handlers
+     * are only set up once. Memory the child inherited is still held, so
+     * only the memory peak starts again from there.
+     */
+#ifdef SHARKYBUF_STATS
+    static bool         installed = false;
+    struct sigaction    sa;
+
+    sb_stats_who_ = who;
+
+    if (installed) {
+        memset(&sb_stats_global, 0, sizeof(sb_stats_global));
+        __atomic_store_n(&(sb_mem_.peak_total), __atomic_load_n(&(sb_mem_.live_total), __ATOMIC_RELAXED),
+                         __ATOMIC_RELAXED);
+        return;
+    }
+
+    installed = true;
+
+    if (atexit(sb_stats_dump_global_) != 0) {
+        fprintf(stderr, "[sb_stats_install] atexit failed.\n");
+        exit(4);
+    }
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = sb_stats_sigusr1_;
+    sa.sa_flags = SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+
+    if (sigaction(SIGUSR1, &sa, NULL) == -1) {
+        perror("[sb_stats_install] sigaction");
+        exit(4);
+    }
+#else
+    (void)who;
+#endif
 }
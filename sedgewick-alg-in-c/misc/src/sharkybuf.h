@@ -4,6 +4,12 @@
 #ifndef SHARKYBUF_H
 #define SHARKYBUF_H
 
+#include <pthread.h>
+#include <stdint.h>
+#ifdef SHARKYBUF_STATS
+#include <time.h>
+#endif
+
 /*
  ***************************************************************
  * sharkybuf.h  Buffer handling utility routines               *
@@ -16,6 +22,107 @@
 #define SHARKYBUF_STRATEGY_MMAP             1
 #define SHARKYBUF_STRATEGY_POSIX_MEMALIGN   2
 #define SHARKYBUF_STRATEGY_MALLOC           3
+#define SHARKYBUF_STRATEGY_EXTERNAL         4
+#define SHARKYBUF_STRATEGY_POOL             5
+#define SHARKYBUF_STRATEGY_FILEMAP          6
+#define SHARKYBUF_STRATEGY_PAGECACHE        7
+#define SHARKYBUF_STRATEGY_CT               8
+
+#define SHARKYBUF_MAX_IOV                   64
+#define SHARKYBUF_BOUNCE_LEN                4096
+#define SHARKYBUF_WAIT_SPIN_LIMIT           16      /* EAGAINs to spin through before polling */
+#define SHARKYBUF_WAIT_SPIN_PAUSES          64
+#define SHARKYBUF_MEM_WAIT_MS               100     /* longest an allocation waits for the soft limit */
+#define SHARKYBUF_MEM_MAX_SHRINKERS         16
+
+#define SHARKYBUF_FRAME_MAGIC               0x52464253      /* "SBFR" */
+
+#define SHARKYBUF_HUGEPAGE_LEN              (2 * 1024 * 1024)
+#define SHARKYBUF_DIRECT_ALIGN              4096    /* O_DIRECT offset, length and address alignment */
+#define SHARKYBUF_WIPE_DONTNEED_LEN         SHARKYBUF_HUGEPAGE_LEN  /* mmap wipes this big drop pages instead */
+
+#define SB_PAGECACHE_BATCH                  32      /* pages per depot magazine */
+#define SB_PAGECACHE_MAX                    (2 * SB_PAGECACHE_BATCH)
+#define SB_PAGECACHE_FRESH                  0x80000000u
+
+#define SB_ARENA_BACKING_MALLOC             0
+#define SB_ARENA_BACKING_MMAP               1
+#define SB_ARENA_BACKING_HUGEPAGE           2
+#define SB_ARENA_MAX_CHUNK_LEN              (64 * 1024 * 1024)
+
+struct iovec;
+struct sb_pool;
+struct sb_pool_slab;
+struct sb_pagealloc;
+
+struct sb_stats {
+    /* I/O and memory counters, only kept if built with -DSHARKYBUF_STATS,
+     * per buffer and (atomically) for the whole process
+     */
+    unsigned long long  bytes_in;       // taken from input fds
+    unsigned long long  bytes_out;      // given to output fds
+    unsigned long long  syscall_ct;     // I/O syscalls issued
+    unsigned long long  short_ct;       // ... which moved less than asked
+    unsigned long long  eintr_ct;       // ... which were interrupted
+    unsigned long long  eagain_ct;      // ... which would have blocked
+    unsigned long long  spin_ct;        // EAGAINs waited out by spinning
+    unsigned long long  poll_ct;        // EAGAINs waited out in poll(2)
+    unsigned long long  blocked_ns;     // time in I/O syscalls and waits
+    unsigned long long  pages_alloc;    // pages mapped or allocated
+    unsigned long long  pages_freed;    // pages unmapped or freed
+};
+
+struct sb_mem_usage {
+    /* bytes held from the system, by strategy - external buffers are never
+     * counted, pools count whole slabs, page allocators pages touched
+     */
+    unsigned long long  live[SHARKYBUF_STRATEGY_CT];
+    unsigned long long  live_total;
+    unsigned long long  peak_total;
+
+    /* soft limit (0 for none), see sb_mem_set_limit(...), and its cost */
+    unsigned long long  limit;
+    unsigned long long  pending;        // bytes no longer in use, but not yet released
+    unsigned long long  shrunk;         // bytes released by shrinkers
+    unsigned long long  wait_ct;        // allocations that waited for others to free memory
+    unsigned long long  wait_ns;        // ... and how long for
+    unsigned long long  over_ct;        // allocations that went over the limit anyway
+};
+
+#ifdef SHARKYBUF_STATS
+extern struct sb_stats sb_stats_global;
+
+static inline unsigned long long sb_stats_now_ns_(void) {
+    struct timespec     ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((unsigned long long)ts.tv_sec * 1000000000ULL) + (unsigned long long)ts.tv_nsec;
+}
+
+// Add n to counter field, for the process and for buffer sb (if not NULL)
+#define SB_STAT(sb, field, n) do {                                              \
+        struct sharkybuf *sb_stat_sb_ = (sb);                                   \
+        __atomic_add_fetch(&(sb_stats_global.field), (n), __ATOMIC_RELAXED);    \
+        if (sb_stat_sb_ != NULL) sb_stat_sb_->stats.field += (n);               \
+    } while (0)
+#define SB_STAT_TIMER(t)        unsigned long long t = sb_stats_now_ns_()
+#define SB_STAT_BLOCKED(sb, t)  SB_STAT(sb, blocked_ns, sb_stats_now_ns_() - (t))
+#define SB_STAT_RESET(sb)       memset(&((sb)->stats), 0, sizeof((sb)->stats))
+#else
+#define SB_STAT(sb, field, n)   do { (void)(sb); } while (0)
+#define SB_STAT_TIMER(t)        do { } while (0)
+#define SB_STAT_BLOCKED(sb, t)  do { } while (0)
+#define SB_STAT_RESET(sb)       do { } while (0)
+#endif
+
+struct sb_fault_cost {
+    /* what it cost to map and populate a SHARKYBUF_STRATEGY_FILEMAP buffer;
+     * major faults had to wait for the disk
+     */
+    long                minflt;
+    long                majflt;
+    unsigned long long  ns;
+};
 
 struct sharkybuf {
     /* buffer information */
@@ -28,22 +135,281 @@ struct sharkybuf {
      */
     bool        dirty;
 
+    /* high-water mark of the writer head, as of the last time it went back
+     * (sb_wipe, sb_rewind, sb_frame_init) - bytes past this and past the
+     * writer head are still zero, so wiping need go no further
+     */
+    size_t      dirty_len;
+
     /* position of writer head */
     char       *writer_ptr;
     size_t      writer_len_remaining;
+
+    /* owning pool and slab, SHARKYBUF_STRATEGY_POOL only */
+    struct sb_pool         *pool;
+    struct sb_pool_slab    *slab;
+
+    /* owning page allocator, SHARKYBUF_STRATEGY_PAGECACHE only */
+    struct sb_pagealloc    *pagealloc;
+
+    /* framing, see sb_frame_init(...) - records appended to the current frame */
+    bool                    framed;
+    uint32_t                frame_record_ct;
+
+#ifdef SHARKYBUF_STATS
+    struct sb_stats         stats;
+#endif
+};
+
+struct sb_frame_hdr {
+    /* at the start of each framed buffer; everything after the payload
+     * is undefined, so neither writers nor readers need zero anything
+     */
+    uint32_t    magic;
+    uint32_t    payload_len;
+    uint32_t    record_ct;
+    uint32_t    reserved;
+};
+
+struct sb_pool_slab {
+    /* one large pre-faulted anonymous mapping, handed out front to back
+     * and never reused, as pages given away with vmsplice(... SPLICE_F_GIFT)
+     * must not be touched again
+     */
+    char                   *addr;
+    size_t                  len;
+    size_t                  handed_out;     // bytes handed out so far
+    size_t                  released;       // bytes disposed of so far, plus one
+                                            //     once no longer current (atomic)
+    struct sb_pool_slab    *next;           // link in retired list
+};
+
+struct sb_pool {
+    size_t                  slab_len;
+    size_t                  low_water;      // refill once current slab has less left than this
+
+    /* current slab, only touched by the thread creating buffers */
+    struct sb_pool_slab    *cur;
+
+    /* handoff to and from the refill thread, protected by lock */
+    pthread_mutex_t         lock;
+    pthread_cond_t          cond;
+    struct sb_pool_slab    *spare;          // mapped and pre-faulted, ready to become cur
+    struct sb_pool_slab    *retired;        // fully released, waiting to be unmapped
+    bool                    refill_wanted;
+    bool                    cur_low;        // current slab is below low_water, spare is next
+    bool                    shutdown;
+    pthread_t               refill_thread;
+};
+
+struct sb_pagealloc {
+    /* fixed-size pages carved from one reservation of max_pages, so a page
+     * is known by its index; free pages travel between threads in
+     * magazines of up to SB_PAGECACHE_BATCH through a lock-free depot
+     */
+    char                   *base;
+    size_t                  page_len;
+    uint32_t                max_pages;
+    uint32_t                bump;           // pages handed out fresh so far
+    uint64_t                depot;          // tag << 32 | (first page of top magazine + 1), 0 if empty
+    uint32_t               *page_next;      // next page in magazine + 1, 0 at the end
+    uint32_t               *mag_next;       // next magazine in depot + 1, first pages only
+    uint32_t               *mag_ct;         // pages in magazine, first pages only
+};
+
+struct sb_pagecache {
+    /* one per thread, never shared: free pages at hand, as indices with
+     * SB_PAGECACHE_FRESH set on pages never used (so still zero)
+     */
+    struct sb_pagealloc    *pa;
+    uint32_t                ct;
+    uint32_t                idx[SB_PAGECACHE_MAX];
+};
+
+struct sb_direct_sink {
+    /* file output bypassing the page cache with O_DIRECT, through two
+     * aligned buffers: one filling while a writer thread writes the other
+     */
+    int                     fd;
+    bool                    direct;         // O_DIRECT in effect - otherwise plain writes
+    bool                    seekable;       // regular file, written with pwrite(2)
+    struct sharkybuf        bufs[2];        // SHARKYBUF_STRATEGY_POSIX_MEMALIGN
+    int                     fill;           // index of the buffer filling
+    uint64_t                fill_off;       // file offset of its first byte
+
+    /* handoff to the writer thread, protected by lock */
+    pthread_mutex_t         lock;
+    pthread_cond_t          cond;
+    int                     inflight;       // index of the buffer being written, -1 if none
+    size_t                  inflight_len;
+    uint64_t                inflight_off;
+    bool                    shutdown;
+    pthread_t               writer_thread;
+};
+
+struct sb_line_iter {
+    /* unscanned part of the buffer being iterated over */
+    const char     *ptr;
+    const char     *end;
+
+    /* start of a record left incomplete at the end of the last buffer */
+    char           *carry;
+    size_t          carry_len;
+    size_t          carry_cap;
+};
+
+struct sb_arena_chunk {
+    /* lives at the start of its own buffer, whose writer head is the
+     * arena's bump pointer
+     */
+    struct sb_arena_chunk  *prev;           // next older chunk
+    struct sharkybuf        sb;
+};
+
+struct sb_arena {
+    int                     backing;        // SB_ARENA_BACKING_*
+    size_t                  next_chunk_len; // doubles with each chunk, up to SB_ARENA_MAX_CHUNK_LEN
+    struct sb_arena_chunk  *cur;            // newest chunk, allocated from
+    size_t                  chunk_ct;
+};
+
+struct sb_arena_mark {
+    struct sb_arena_chunk  *chunk;
+    char                   *ptr;
+};
+
+struct sb_chain_link {
+    struct sb_chain_link   *next;
+    struct sharkybuf        sb;             // content is up to the writer head
+};
+
+struct sb_chain {
+    /* rope of fixed-size mmap buffers, appended to at the tail; nothing is
+     * ever moved or grown, so appending never copies what's already there
+     */
+    struct sb_chain_link   *head;
+    struct sb_chain_link   *tail;
+    struct sb_chain_link   *spare;          // links kept for reuse once written out
+    size_t                  page_len;       // size of each new link's buffer
+    size_t                  len;            // content bytes in the whole chain
+    int                     link_ct;
+};
+
+struct sb_chain_handoff {
+    /* mailbox passing chain contents from producer threads to a consumer
+     * thread by moving links, without copying or going through a pipe
+     */
+    pthread_mutex_t         lock;
+    pthread_cond_t          cond;
+    struct sb_chain         chain;          // links posted and not yet taken, and
+                                            //     written-out spares on their way back
+    bool                    closed;
 };
 
 void sb_create_mmap(struct sharkybuf *sb, size_t len);
+void sb_create_mmap_huge(struct sharkybuf *sb, size_t len);
 void sb_create_posix_memalign(struct sharkybuf *sb, size_t len);
 void sb_create_malloc(struct sharkybuf *sb, size_t len);
+void sb_create_external(struct sharkybuf *sb, void *addr, size_t len);
+void sb_create_filemap(struct sharkybuf *sb, const char *path, struct sb_fault_cost *cost);
+void sb_create_pool(struct sharkybuf *sb, struct sb_pool *pool, size_t len);
+void sb_create_pagecache(struct sharkybuf *sb, struct sb_pagecache *pc);
+void sb_realloc_malloc_(struct sharkybuf *sb, size_t new_len);
+void sb_realloc_mremap_(struct sharkybuf *sb, size_t new_len);
 void sb_realloc(struct sharkybuf *sb, size_t new_len);
 void sb_dispose_munmap_(struct sharkybuf *sb);
 void sb_dispose_free_(struct sharkybuf *sb);
+void sb_dispose_filemap_(struct sharkybuf *sb);
+void sb_dispose_pool_(struct sharkybuf *sb);
+void sb_dispose_pagecache_(struct sharkybuf *sb);
 void sb_dispose(struct sharkybuf *sb);
 void sb_wipe(struct sharkybuf *sb);
+void sb_rewind(struct sharkybuf *sb);
+int sb_append_line(struct sharkybuf *sb, char *line);
 int sb_append_line_or_zeroes(struct sharkybuf *sb, char *line);
+size_t sb_append_bytes(struct sharkybuf *sb, const void *src, size_t len);
+size_t sb_append_record(struct sharkybuf *sb, const char *rec, size_t len, char sep);
+size_t sb_append_u64(struct sharkybuf *sb, uint64_t v, char sep);
+size_t sb_append_u32(struct sharkybuf *sb, uint32_t v, char sep);
+size_t sb_append_iov(struct sharkybuf *sb, const struct iovec *iov, int iov_ct);
 int sb_recvbuf_read(struct sharkybuf *sb, int fd);
+int sb_recvbuf_read_avail(struct sharkybuf *sb, int fd);
+void sb_sendbufs_vmsplice(struct sharkybuf *sbs, int sb_ct, int fd);
 void sb_sendbuf_vmsplice(struct sharkybuf *sb, int fd);
+size_t sb_pipe_set_size(int fd, size_t want_len);
+size_t sb_content_len(struct sharkybuf *sb);
+void sb_buf_to_fd(struct sharkybuf *sb, int fd);
 void sb_buf_to_stdout(struct sharkybuf *sb);
+void sb_frame_init(struct sharkybuf *sb);
+void sb_frame_seal(struct sharkybuf *sb);
+void sb_frame_payload(struct sharkybuf *sb, char **payload_ptr, size_t *payload_len);
+void sb_frame_payload_to_fd(struct sharkybuf *sb, int fd);
+void sb_splice_frames_to_fd(int fd, int out_fd, size_t frame_len);
+void sb_tee_fanout(int in_fd, int tee_fd, int out_fd);
+void sb_pool_init(struct sb_pool *pool, size_t slab_len);
+void sb_pool_destroy(struct sb_pool *pool);
+void sb_pagealloc_init(struct sb_pagealloc *pa, size_t page_len, uint32_t max_pages);
+void sb_pagealloc_destroy(struct sb_pagealloc *pa);
+void sb_pagecache_init(struct sb_pagecache *pc, struct sb_pagealloc *pa);
+void sb_pagecache_bind(struct sb_pagecache *pc);
+void *sb_pagecache_get(struct sb_pagecache *pc, bool *fresh);
+void sb_pagecache_put(struct sb_pagecache *pc, void *page);
+void sb_pagecache_flush(struct sb_pagecache *pc);
+void sb_direct_open(struct sb_direct_sink *sink, const char *path, size_t buf_len);
+void sb_direct_write(struct sb_direct_sink *sink, const void *src, size_t len);
+void sb_direct_close(struct sb_direct_sink *sink);
+void sb_mem_set_limit(size_t limit);
+void sb_mem_usage(struct sb_mem_usage *u);
+void sb_mem_shrinker_add(size_t (*fn)(void *arg), void *arg);
+void sb_mem_shrinker_remove(size_t (*fn)(void *arg), void *arg);
+void sb_mem_dump(int fd, const char *who);
+void sb_stats_dump(int fd, const char *who, const struct sb_stats *st);
+void sb_stats_install(const char *who);
+void sb_line_iter_init(struct sb_line_iter *it);
+void sb_line_iter_feed(struct sb_line_iter *it, const char *ptr, size_t len);
+bool sb_line_iter_next(struct sb_line_iter *it, const char **rec, size_t *rec_len);
+bool sb_line_iter_finish(struct sb_line_iter *it, const char **rec, size_t *rec_len);
+void sb_line_iter_dispose(struct sb_line_iter *it);
+void sb_chain_init(struct sb_chain *ch, size_t page_len);
+void sb_chain_append_bytes(struct sb_chain *ch, const void *src, size_t len);
+void sb_chain_append_record(struct sb_chain *ch, const char *rec, size_t len, char sep);
+void sb_chain_move(struct sb_chain *dst, struct sb_chain *src);
+void sb_chain_writev(struct sb_chain *ch, int fd);
+void sb_chain_vmsplice(struct sb_chain *ch, int fd);
+void sb_chain_dispose(struct sb_chain *ch);
+void sb_chain_handoff_init(struct sb_chain_handoff *h);
+void sb_chain_handoff_post(struct sb_chain_handoff *h, struct sb_chain *ch);
+int sb_chain_handoff_take(struct sb_chain_handoff *h, struct sb_chain *ch, bool wait);
+void sb_chain_handoff_close(struct sb_chain_handoff *h);
+void sb_chain_handoff_destroy(struct sb_chain_handoff *h);
+void sb_arena_init(struct sb_arena *a, size_t first_chunk_len, int backing);
+void *sb_arena_alloc_chunk_(struct sb_arena *a, size_t len, size_t align);
+void sb_arena_mark(struct sb_arena *a, struct sb_arena_mark *mark);
+void sb_arena_reset(struct sb_arena *a, const struct sb_arena_mark *mark);
+void sb_arena_destroy(struct sb_arena *a);
+
+static inline void *sb_arena_alloc(struct sb_arena *a, size_t len, size_t align) {
+    /*
+     * Allocate len bytes aligned to align (a power of two) from arena a.
+     * Only ever freed in bulk, by sb_arena_reset(...) or sb_arena_destroy(...).
+     */
+    struct sharkybuf   *sb;
+    size_t              pad;
+    char               *ptr;
+
+    if (a->cur != NULL) {
+        sb = &(a->cur->sb);
+        pad = (size_t)(-(uintptr_t)(sb->writer_ptr)) & (align - 1);
+
+        if (pad + len <= sb->writer_len_remaining) {
+            ptr = sb->writer_ptr + pad;
+            sb->writer_ptr = ptr + len;
+            sb->writer_len_remaining -= pad + len;
+            return ptr;
+        }
+    }
+
+    return sb_arena_alloc_chunk_(a, len, align);
+}
 
 #endif /* SHARKYBUF_H */
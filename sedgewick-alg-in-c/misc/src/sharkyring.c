@@ -0,0 +1,354 @@
+
+/* vim: set ts=8 sts=4 sw=4 et filetype=c: */
+
+#include <assert.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "sharkybuf.h"
+#include "sharkyring.h"
+
+/*
+ ***************************************************************
+ * sharkyring.c Single-producer/single-consumer ring of        *
+ *              sharkybuf slots                                *
+ *                                                             *
+ ***************************************************************
+ */
+
+
+static inline void sr_cpu_relax_(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#endif
+}
+
+static bool sr_futex_wait_(unsigned *addr, unsigned val, int flags, const struct timespec *timeout) {
+    /*
+     * Sleep until *addr is woken, unless *addr no longer holds val, for
+     * no longer than timeout (if not NULL)
+     *
+     * Returns:
+     *      true if timeout ran out
+     */
+    long            fx_rv;
+    SB_STAT_TIMER(t);
+
+    fx_rv = syscall(SYS_futex, addr, FUTEX_WAIT | flags, val, timeout, NULL, 0);
+    SB_STAT(NULL, syscall_ct, 1);
+    SB_STAT_BLOCKED(NULL, t);
+
+    if (fx_rv == -1) {
+        switch (errno) {
+            case ETIMEDOUT:
+                return true;
+            case EAGAIN:
+            case EINTR:
+                // Value already changed, or interrupted - caller re-checks
+                return false;
+            default:
+                perror("[sr_futex_wait_] futex");
+                exit(4);
+        }
+    }
+
+    return false;
+}
+
+static const struct timespec sr_peer_check_ = {
+    .tv_sec = SHARKYRING_PEER_CHECK_MS / 1000,
+    .tv_nsec = (SHARKYRING_PEER_CHECK_MS % 1000) * 1000000L
+};
+
+static void sr_check_peer_(struct sharkyring *sr, const char *who) {
+    /*
+     * Exit if the peer process set with sr_watch_peer(...) has gone -
+     * nobody is left to wake us, so waiting any longer would hang. A
+     * child that has exited is checked for without reaping it, so that
+     * its parent can still wait for it.
+     */
+    siginfo_t       info;
+
+    if (sr->peer_pid == 0) return;
+
+    memset(&info, 0, sizeof(info));
+
+    if (waitid(P_PID, (id_t)sr->peer_pid, &info, WEXITED | WNOHANG | WNOWAIT) == 0) {
+        if (info.si_pid == 0) return;
+    } else if (errno != ECHILD || kill(sr->peer_pid, 0) == 0 || errno != ESRCH) {
+        // Still running, or not our child and still there
+        return;
+    }
+
+    fprintf(stderr, "%s %d has gone away.\n", who, (int)sr->peer_pid);
+    exit(4);
+}
+
+static void sr_futex_wake_(unsigned *addr, int flags) {
+    if (syscall(SYS_futex, addr, FUTEX_WAKE | flags, INT_MAX, NULL, NULL, 0) == -1) {
+        perror("[sr_futex_wake_] futex");
+        exit(4);
+    }
+}
+
+static void sr_create_(struct sharkyring *sr, unsigned slot_ct, size_t slot_len, bool shared) {
+    /*
+     * Create a ring of slot_ct slots, each a sharkybuf of slot_len bytes,
+     * all carved out of one anonymous mapping - shared, so that it stays
+     * shared with child processes, if shared is true.
+     *
+     * Asserts:
+     *      sr is not NULL
+     *      slot_ct is a power of two
+     *      slot_len is an exact multiple of system page size
+     */
+    size_t          page_size;
+    size_t          hdr_len;
+    size_t          ctl_len, slots_len;
+    char           *region;
+
+    // Pre-flight checks
+    page_size = (size_t)sysconf(_SC_PAGESIZE);
+
+    assert(sr != NULL);
+    assert(slot_ct > 0 && (slot_ct & (slot_ct - 1)) == 0);
+    assert(slot_len > 0 && (slot_len % page_size) == 0);
+
+    // Lay out control block, slot structs and end-of-stream markers,
+    // rounded up to a whole number of pages, followed by the slot pages
+    ctl_len = (sizeof(struct sharkyring_ctl) + SHARKYRING_CACHELINE - 1) & ~(size_t)(SHARKYRING_CACHELINE - 1);
+    slots_len = slot_ct * sizeof(struct sharkybuf);
+    hdr_len = ctl_len + slots_len + slot_ct;
+    hdr_len = (hdr_len + page_size - 1) / page_size * page_size;
+
+    sr->region_len = hdr_len + (slot_ct * slot_len);
+
+    // Perform mmap - fresh anonymous pages are already zeroed
+    region = mmap(0, sr->region_len, PROT_READ | PROT_WRITE,
+                  (shared ? MAP_SHARED : MAP_PRIVATE) | MAP_ANONYMOUS, -1, 0);
+
+    if (region == MAP_FAILED) {
+        perror("[sr_create] mmap");
+        exit(4);
+    }
+
+    // Populate struct
+    sr->region = region;
+    sr->ctl = (struct sharkyring_ctl*)region;
+    sr->slots = (struct sharkybuf*)(region + ctl_len);
+    sr->slot_eof = (unsigned char*)(region + ctl_len + slots_len);
+    sr->mask = slot_ct - 1;
+    sr->peer_pid = 0;
+
+    sr->ctl->slot_ct = slot_ct;
+    sr->ctl->slot_len = slot_len;
+    // Private futexes are cheaper, but are only seen by the process
+    // that waits on them
+    sr->ctl->futex_flags = shared ? 0 : FUTEX_PRIVATE_FLAG;
+
+    for (unsigned i = 0; i < slot_ct; i++)
+        sb_create_external(&(sr->slots[i]), region + hdr_len + (i * slot_len), slot_len);
+}
+
+void sr_create(struct sharkyring *sr, unsigned slot_ct, size_t slot_len) {
+    /*
+     * Create a ring for use between threads of one process
+     */
+    sr_create_(sr, slot_ct, slot_len, false);
+}
+
+void sr_create_shared(struct sharkyring *sr, unsigned slot_ct, size_t slot_len) {
+    /*
+     * Create a ring for use between processes: call before fork(2), and
+     * each process then uses it as its own end of the ring, and disposes
+     * of it with sr_dispose(...). The slots' sharkybufs point into the
+     * mapping, which is at the same address in both processes.
+     */
+    sr_create_(sr, slot_ct, slot_len, true);
+}
+
+void sr_watch_peer(struct sharkyring *sr, pid_t peer_pid) {
+    /*
+     * For rings shared between processes: have this end of the ring check
+     * every SHARKYRING_PEER_CHECK_MS while it sleeps that peer_pid, the
+     * process at the other end, is still alive, and exit(4) if it isn't -
+     * as a pipe would raise SIGPIPE or EOF. 0 stops checking.
+     */
+    sr->peer_pid = peer_pid;
+}
+
+void sr_dispose(struct sharkyring *sr) {
+    /*
+     * Unmap the ring, including every slot buffer
+     *
+     * Asserts:
+     *      sr is not NULL
+     *      sr->region is not NULL
+     */
+
+    // Pre-flight checks
+    assert(sr != NULL);
+    assert(sr->region != NULL);
+
+    if (munmap(sr->region, sr->region_len) == -1) {
+        perror("[sr_dispose] munmap");
+        exit(4);
+    }
+
+    // Clear struct
+    sr->region = NULL;
+    sr->region_len = 0;
+    sr->ctl = NULL;
+    sr->slots = NULL;
+    sr->slot_eof = NULL;
+    sr->mask = 0;
+}
+
+struct sharkybuf* sr_produce_begin(struct sharkyring *sr) {
+    /*
+     * Wait for a free slot, and return it wiped and ready for writing.
+     * Spins briefly first, and only sleeps on a futex if the ring stays full.
+     *
+     * Returns:
+     *      pointer to the slot's sharkybuf, owned by the producer until
+     *      sr_produce_commit(...) is called
+     */
+    struct sharkyring_ctl  *ctl = sr->ctl;
+    struct sharkybuf       *sb;
+    unsigned                head, tail;
+
+    head = __atomic_load_n(&(ctl->head), __ATOMIC_RELAXED);
+
+    for (int spins = 0; ; spins++) {
+        tail = __atomic_load_n(&(ctl->tail), __ATOMIC_ACQUIRE);
+        if ((head - tail) < ctl->slot_ct) break;
+
+        if (spins < SHARKYRING_SPIN_LIMIT) {
+            sr_cpu_relax_();
+            continue;
+        }
+
+        // Ring full - announce that we're about to sleep, then re-check
+        // so that a release racing with us can't be missed
+        __atomic_store_n(&(ctl->producer_waiting), 1, __ATOMIC_SEQ_CST);
+        tail = __atomic_load_n(&(ctl->tail), __ATOMIC_SEQ_CST);
+
+        if ((head - tail) < ctl->slot_ct) break;
+
+        if (sr_futex_wait_(&(ctl->tail), tail, ctl->futex_flags, sr->peer_pid ? &sr_peer_check_ : NULL))
+            sr_check_peer_(sr, "[sr_produce_begin] consumer");
+    }
+
+    sb = &(sr->slots[head & sr->mask]);
+    sr->slot_eof[head & sr->mask] = 0;
+    sb_wipe(sb);
+
+    return sb;
+}
+
+void sr_produce_commit(struct sharkyring *sr) {
+    /*
+     * Publish the slot returned by the last sr_produce_begin(...),
+     * waking the consumer only if it went to sleep on an empty ring
+     */
+    struct sharkyring_ctl  *ctl = sr->ctl;
+    unsigned                head;
+
+    head = __atomic_load_n(&(ctl->head), __ATOMIC_RELAXED);
+    __atomic_store_n(&(ctl->head), head + 1, __ATOMIC_SEQ_CST);
+
+    if (__atomic_load_n(&(ctl->consumer_waiting), __ATOMIC_SEQ_CST) &&
+        __atomic_exchange_n(&(ctl->consumer_waiting), 0, __ATOMIC_SEQ_CST))
+        sr_futex_wake_(&(ctl->head), ctl->futex_flags);
+}
+
+void sr_produce_close(struct sharkyring *sr) {
+    /*
+     * Publish an end-of-stream marker. The consumer sees SHARKYRING_EOF
+     * once it has consumed every slot published before this one.
+     */
+    sr_produce_begin(sr);
+    sr->slot_eof[sr->ctl->head & sr->mask] = 1;
+    sr_produce_commit(sr);
+}
+
+int sr_consume_begin(struct sharkyring *sr, struct sharkybuf **sbp, bool wait) {
+    /*
+     * Get the oldest published slot. If wait is true, spin briefly and
+     * then sleep on a futex until one is published.
+     *
+     * Returns:
+     *      SHARKYRING_OK on success, with *sbp set to the slot, owned by
+     *          the consumer until sr_consume_commit(...) is called
+     *      SHARKYRING_EOF if the producer has closed the ring and every
+     *          slot has been consumed
+     *      SHARKYRING_EMPTY if wait is false and nothing is published
+     *
+     * Asserts:
+     *      sbp is not NULL
+     */
+    struct sharkyring_ctl  *ctl = sr->ctl;
+    unsigned                head, tail;
+
+    // Pre-flight checks
+    assert(sbp != NULL);
+
+    tail = __atomic_load_n(&(ctl->tail), __ATOMIC_RELAXED);
+
+    for (int spins = 0; ; spins++) {
+        head = __atomic_load_n(&(ctl->head), __ATOMIC_ACQUIRE);
+        if (head != tail) break;
+
+        if (!wait) return SHARKYRING_EMPTY;
+
+        if (spins < SHARKYRING_SPIN_LIMIT) {
+            sr_cpu_relax_();
+            continue;
+        }
+
+        // Ring empty - announce that we're about to sleep, then re-check
+        __atomic_store_n(&(ctl->consumer_waiting), 1, __ATOMIC_SEQ_CST);
+        head = __atomic_load_n(&(ctl->head), __ATOMIC_SEQ_CST);
+
+        if (head != tail) break;
+
+        if (sr_futex_wait_(&(ctl->head), head, ctl->futex_flags, sr->peer_pid ? &sr_peer_check_ : NULL))
+            sr_check_peer_(sr, "[sr_consume_begin] producer");
+    }
+
+    // The end-of-stream marker is never released, so every later call
+    // reports EOF too
+    if (sr->slot_eof[tail & sr->mask]) return SHARKYRING_EOF;
+
+    *sbp = &(sr->slots[tail & sr->mask]);
+    return SHARKYRING_OK;
+}
+
+void sr_consume_commit(struct sharkyring *sr) {
+    /*
+     * Release the slot returned by the last sr_consume_begin(...) back to
+     * the producer, waking it only if it went to sleep on a full ring
+     */
+    struct sharkyring_ctl  *ctl = sr->ctl;
+    unsigned                tail;
+
+    tail = __atomic_load_n(&(ctl->tail), __ATOMIC_RELAXED);
+    __atomic_store_n(&(ctl->tail), tail + 1, __ATOMIC_SEQ_CST);
+
+    if (__atomic_load_n(&(ctl->producer_waiting), __ATOMIC_SEQ_CST) &&
+        __atomic_exchange_n(&(ctl->producer_waiting), 0, __ATOMIC_SEQ_CST))
+        sr_futex_wake_(&(ctl->tail), ctl->futex_flags);
+}
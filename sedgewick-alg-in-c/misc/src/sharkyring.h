@@ -0,0 +1,65 @@
+
+/* vim: set ts=8 sts=4 sw=4 et filetype=c: */
+
+#ifndef SHARKYRING_H
+#define SHARKYRING_H
+
+/*
+ ***************************************************************
+ * sharkyring.h Single-producer/single-consumer ring of        *
+ *              sharkybuf slots                                *
+ *                                                             *
+ ***************************************************************
+ */
+
+
+#define SHARKYRING_CACHELINE    64
+#define SHARKYRING_SPIN_LIMIT   1000
+#define SHARKYRING_PEER_CHECK_MS 100    /* how often a sleeper checks its peer process is alive */
+
+#define SHARKYRING_OK           0
+#define SHARKYRING_EOF          1
+#define SHARKYRING_EMPTY        2
+
+struct sharkyring_ctl {
+    /* producer side: number of slots published so far */
+    unsigned    head __attribute__((aligned(SHARKYRING_CACHELINE)));
+    unsigned    producer_waiting;
+
+    /* consumer side: number of slots released so far */
+    unsigned    tail __attribute__((aligned(SHARKYRING_CACHELINE)));
+    unsigned    consumer_waiting;
+
+    /* geometry, fixed at creation */
+    unsigned    slot_ct __attribute__((aligned(SHARKYRING_CACHELINE)));
+    size_t      slot_len;
+    int         futex_flags;
+};
+
+struct sharkyring {
+    /* one mapping holds the control block, the slot structs,
+     * the slot end-of-stream markers and the slot pages
+     */
+    void                   *region;
+    size_t                  region_len;
+
+    struct sharkyring_ctl  *ctl;
+    struct sharkybuf       *slots;
+    unsigned char          *slot_eof;
+    unsigned                mask;
+
+    /* process at the other end, see sr_watch_peer(...) - 0 if none */
+    pid_t                   peer_pid;
+};
+
+void sr_create(struct sharkyring *sr, unsigned slot_ct, size_t slot_len);
+void sr_create_shared(struct sharkyring *sr, unsigned slot_ct, size_t slot_len);
+void sr_watch_peer(struct sharkyring *sr, pid_t peer_pid);
+void sr_dispose(struct sharkyring *sr);
+struct sharkybuf* sr_produce_begin(struct sharkyring *sr);
+void sr_produce_commit(struct sharkyring *sr);
+void sr_produce_close(struct sharkyring *sr);
+int sr_consume_begin(struct sharkyring *sr, struct sharkybuf **sbp, bool wait);
+void sr_consume_commit(struct sharkyring *sr);
+
+#endif /* SHARKYRING_H */
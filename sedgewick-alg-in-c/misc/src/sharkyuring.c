@@ -0,0 +1,521 @@
+
+/* vim: set ts=8 sts=4 sw=4 et filetype=c: */
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+
+#include "sharkybuf.h"
+#include "sharkyuring.h"
+
+/*
+ ***************************************************************
+ * sharkyuring.c    io_uring I/O engine for sharkybufs, using  *
+ *                  raw syscalls                               *
+ *                                                             *
+ ***************************************************************
+ */
+
+
+// su_copy_bufs(...) user_data: buffer index, plus this bit for writes
+#define SU_COPY_WRITE   (1ULL << 32)
+
+struct su_copy_slot_ {
+    struct sharkybuf    sb;
+
+    /* what's left of the buffer's write */
+    const char         *wr_ptr;
+    size_t              wr_len;
+    uint64_t            wr_off;
+    bool                wr_done;
+};
+
+
+int su_create(struct sharkyuring *su, unsigned entries) {
+    /*
+     * Set up an io_uring instance with room for entries submissions,
+     * and map its rings
+     *
+     * Returns:
+     *      0 on success
+     *      -1 if io_uring isn't available (not built into the kernel,
+     *          disabled by sysctl, or blocked by seccomp)
+     *
+     * Asserts:
+     *      su is not NULL
+     */
+    struct io_uring_params  p;
+    int                     ring_fd;
+
+    // Pre-flight checks
+    assert(su != NULL);
+
+    memset(su, 0, sizeof(*su));
+    memset(&p, 0, sizeof(p));
+
+    ring_fd = (int)syscall(__NR_io_uring_setup, entries, &p);
+
+    if (ring_fd == -1) {
+        switch (errno) {
+            case ENOSYS:
+            case EPERM:
+            case EACCES:
+            case EINVAL:
+                return -1;
+            default:
+                perror("[su_create] io_uring_setup");
+                exit(4);
+        }
+    }
+
+    su->ring_fd = ring_fd;
+    su->entries = p.sq_entries;
+
+    // Work out ring sizes - newer kernels map both rings together
+    su->sq_ring_len = p.sq_off.array + (p.sq_entries * sizeof(unsigned));
+    su->cq_ring_len = p.cq_off.cqes + (p.cq_entries * sizeof(struct io_uring_cqe));
+
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        if (su->cq_ring_len > su->sq_ring_len) su->sq_ring_len = su->cq_ring_len;
+        su->cq_ring_len = su->sq_ring_len;
+    }
+
+    // Map rings and submission queue entries
+    su->sq_ring = mmap(0, su->sq_ring_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                       ring_fd, IORING_OFF_SQ_RING);
+
+    if (su->sq_ring == MAP_FAILED) {
+        perror("[su_create] mmap");
+        exit(4);
+    }
+
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        su->cq_ring = su->sq_ring;
+    } else {
+        su->cq_ring = mmap(0, su->cq_ring_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                           ring_fd, IORING_OFF_CQ_RING);
+
+        if (su->cq_ring == MAP_FAILED) {
+            perror("[su_create] mmap");
+            exit(4);
+        }
+    }
+
+    su->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+    su->sqes = mmap(0, su->sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                    ring_fd, IORING_OFF_SQES);
+
+    if (su->sqes == MAP_FAILED) {
+        perror("[su_create] mmap");
+        exit(4);
+    }
+
+    // Populate struct
+    su->sq_head = (unsigned*)((char*)(su->sq_ring) + p.sq_off.head);
+    su->sq_tail = (unsigned*)((char*)(su->sq_ring) + p.sq_off.tail);
+    su->sq_mask = (unsigned*)((char*)(su->sq_ring) + p.sq_off.ring_mask);
+    su->sq_array = (unsigned*)((char*)(su->sq_ring) + p.sq_off.array);
+
+    su->cq_head = (unsigned*)((char*)(su->cq_ring) + p.cq_off.head);
+    su->cq_tail = (unsigned*)((char*)(su->cq_ring) + p.cq_off.tail);
+    su->cq_mask = (unsigned*)((char*)(su->cq_ring) + p.cq_off.ring_mask);
+    su->cqes = (struct io_uring_cqe*)((char*)(su->cq_ring) + p.cq_off.cqes);
+
+    return 0;
+}
+
+void su_dispose(struct sharkyuring *su) {
+    /*
+     * Unmap the rings and close the io_uring instance, which also
+     * unregisters any fixed buffers
+     *
+     * Asserts:
+     *      su is not NULL
+     *      nothing is in flight
+     */
+
+    // Pre-flight checks
+    assert(su != NULL);
+    assert(su->inflight == 0);
+
+    if (munmap(su->sqes, su->sqes_len) == -1 ||
+        (su->cq_ring != su->sq_ring && munmap(su->cq_ring, su->cq_ring_len) == -1) ||
+        munmap(su->sq_ring, su->sq_ring_len) == -1) {
+        perror("[su_dispose] munmap");
+        exit(4);
+    }
+
+    close(su->ring_fd);
+
+    // Clear struct
+    memset(su, 0, sizeof(*su));
+    su->ring_fd = -1;
+}
+
+int su_register_bufs(struct sharkyuring *su, struct sharkybuf *sbs, int sb_ct) {
+    /*
+     * Register sbs[0..sb_ct-1] as fixed buffers, so the kernel pins and
+     * maps them once rather than on every request. Buffer indexes passed
+     * to su_prep_*_fixed(...) are indexes into sbs.
+     *
+     * Returns:
+     *      0 on success
+     *      -1 if the kernel refused, e.g. over RLIMIT_MEMLOCK
+     *
+     * Asserts:
+     *      0 < sb_ct <= SHARKYURING_MAX_BUFS
+     */
+    struct iovec    iov[SHARKYURING_MAX_BUFS];
+
+    // Pre-flight checks
+    assert(sb_ct > 0 && sb_ct <= SHARKYURING_MAX_BUFS);
+
+    for (int i = 0; i < sb_ct; i++) {
+        iov[i].iov_base = sbs[i].addr;
+        iov[i].iov_len = sbs[i].len;
+    }
+
+    if (syscall(__NR_io_uring_register, su->ring_fd, IORING_REGISTER_BUFFERS, iov, sb_ct) == -1)
+        return -1;
+
+    su->bufs_registered = true;
+    return 0;
+}
+
+static struct io_uring_sqe *su_next_sqe_(struct sharkyuring *su) {
+    /*
+     * Get the next free submission queue entry, cleared, submitting what's
+     * queued so far if the queue is full. Published by su_commit_sqe_(...).
+     */
+    struct io_uring_sqe    *sqe;
+    unsigned                tail;
+
+    tail = *(su->sq_tail);
+
+    while ((tail - __atomic_load_n(su->sq_head, __ATOMIC_ACQUIRE)) >= su->entries)
+        su_submit(su, 0);
+
+    sqe = &(su->sqes[tail & *(su->sq_mask)]);
+    memset(sqe, 0, sizeof(*sqe));
+
+    return sqe;
+}
+
+static void su_commit_sqe_(struct sharkyuring *su) {
+    unsigned                tail;
+
+    tail = *(su->sq_tail);
+    su->sq_array[tail & *(su->sq_mask)] = tail & *(su->sq_mask);
+
+    __atomic_store_n(su->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    su->inflight++;
+}
+
+void su_prep_read_fixed(struct sharkyuring *su, int fd, struct sharkybuf *sb, int buf_idx, uint64_t user_data) {
+    /*
+     * Queue a read from fd's current position into the unwritten part of
+     * registered buffer sb (fixed buffer buf_idx). Not submitted until
+     * su_submit(...).
+     *
+     * Asserts:
+     *      su->bufs_registered
+     */
+    struct io_uring_sqe    *sqe;
+
+    // Pre-flight checks
+    assert(su->bufs_registered);
+
+    sqe = su_next_sqe_(su);
+    sqe->opcode = IORING_OP_READ_FIXED;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)(uintptr_t)(sb->writer_ptr);
+    sqe->len = (uint32_t)(sb->writer_len_remaining);
+    sqe->off = SHARKYURING_OFF_CUR;
+    sqe->buf_index = (uint16_t)buf_idx;
+    sqe->user_data = user_data;
+
+    su_commit_sqe_(su);
+}
+
+void su_prep_write_fixed(struct sharkyuring *su, int fd, const char *ptr, size_t len, int buf_idx,
+                         uint64_t off, uint64_t user_data) {
+    /*
+     * Queue a write of len bytes at ptr, which lies within fixed buffer
+     * buf_idx, to fd at offset off (or SHARKYURING_OFF_CUR). Not submitted
+     * until su_submit(...).
+     *
+     * Asserts:
+     *      su->bufs_registered
+     */
+    struct io_uring_sqe    *sqe;
+
+    // Pre-flight checks
+    assert(su->bufs_registered);
+
+    sqe = su_next_sqe_(su);
+    sqe->opcode = IORING_OP_WRITE_FIXED;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)(uintptr_t)ptr;
+    sqe->len = (uint32_t)len;
+    sqe->off = off;
+    sqe->buf_index = (uint16_t)buf_idx;
+    sqe->user_data = user_data;
+
+    su_commit_sqe_(su);
+}
+
+void su_submit(struct sharkyuring *su, unsigned wait_ct) {
+    /*
+     * Submit everything queued so far in one io_uring_enter(2), and wait
+     * until at least wait_ct completions are ready to reap
+     */
+    unsigned        to_submit;
+    long            enter_rv;
+
+    while (true) {
+        SB_STAT_TIMER(t);
+
+        to_submit = *(su->sq_tail) - __atomic_load_n(su->sq_head, __ATOMIC_ACQUIRE);
+
+        enter_rv = syscall(__NR_io_uring_enter, su->ring_fd, to_submit, wait_ct,
+                           (wait_ct > 0) ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+        SB_STAT(NULL, syscall_ct, 1);
+        SB_STAT_BLOCKED(NULL, t);
+
+        if (enter_rv != -1)
+            return;
+
+        SB_STAT(NULL, eintr_ct, (errno == EINTR) ? 1 : 0);
+        SB_STAT(NULL, eagain_ct, (errno == EAGAIN) ? 1 : 0);
+
+        switch (errno) {
+            case EINTR:
+            case EAGAIN:
+                // Try again - anything already consumed has moved sq_head
+                continue;
+            default:
+                perror("[su_submit] io_uring_enter");
+                exit(4);
+        }
+    }
+}
+
+bool su_reap(struct sharkyuring *su, uint64_t *user_data, int *res) {
+    /*
+     * Take one completion off the completion queue, without waiting
+     *
+     * Returns:
+     *      true with *user_data and *res set, if there was one
+     *      false if the completion queue is empty
+     */
+    struct io_uring_cqe    *cqe;
+    unsigned                head;
+
+    head = *(su->cq_head);
+
+    if (head == __atomic_load_n(su->cq_tail, __ATOMIC_ACQUIRE))
+        return false;
+
+    cqe = &(su->cqes[head & *(su->cq_mask)]);
+    *user_data = cqe->user_data;
+    *res = cqe->res;
+
+    __atomic_store_n(su->cq_head, head + 1, __ATOMIC_RELEASE);
+    su->inflight--;
+
+    return true;
+}
+
+static void su_copy_prep_write_(struct sharkyuring *su, struct su_copy_slot_ *slot, int idx, int out_fd) {
+    su_prep_write_fixed(su, out_fd, slot->wr_ptr, slot->wr_len, idx, slot->wr_off, SU_COPY_WRITE | (uint64_t)idx);
+}
+
+int su_copy_bufs(int in_fd, int out_fd, size_t buf_len, int buf_ct, bool framed) {
+    /*
+     * Copy buffers of buf_len bytes from in_fd (normally a pipe) to out_fd
+     * until EOF, writing only the content of each buffer, without trailing
+     * null bytes - or, if framed, just the payload given by its frame header.
+     *
+     * One read is kept in flight ahead of the writes, into the next of buf_ct
+     * registered buffers. Writes to a seekable out_fd all go out together at
+     * explicit offsets; otherwise they're issued one at a time, in order.
+     *
+     * Returns:
+     *      0 on success
+     *      -1 if io_uring isn't available, before anything has been read,
+     *          so the caller can fall back to read(2)/write(2)
+     *
+     * Asserts:
+     *      0 < buf_ct <= SHARKYURING_MAX_BUFS
+     */
+    struct sharkyuring      su;
+    struct sharkybuf        sbs[SHARKYURING_MAX_BUFS];
+    struct su_copy_slot_    slot[SHARKYURING_MAX_BUFS];
+    struct su_copy_slot_   *s;
+    uint64_t                rd_seq = 0;         // buffers filled
+    uint64_t                wr_seq = 0;         // buffers queued for writing
+    uint64_t                done_seq = 0;       // buffers written and free again
+    uint64_t                user_data;
+    off_t                   out_off;
+    bool                    seekable;
+    bool                    eof = false;
+    bool                    read_inflight = false;
+    int                     write_inflight = 0;
+    int                     fl, idx, res;
+    char                   *payload_ptr;
+    size_t                  payload_len;
+
+    // Pre-flight checks
+    assert(buf_ct > 0 && buf_ct <= SHARKYURING_MAX_BUFS);
+
+    if (su_create(&su, (unsigned)(2 * buf_ct)) == -1)
+        return -1;
+
+    // Allocate buffers, page-aligned, the same size as the producer's
+    for (int i = 0; i < buf_ct; i++) {
+        memset(&(slot[i]), 0, sizeof(slot[i]));
+        sb_create_posix_memalign(&(slot[i].sb), buf_len);
+        sbs[i] = slot[i].sb;
+    }
+
+    if (su_register_bufs(&su, sbs, buf_ct) == -1) {
+        for (int i = 0; i < buf_ct; i++)
+            sb_dispose(&(slot[i].sb));
+        su_dispose(&su);
+        return -1;
+    }
+
+    // Writes to an O_APPEND file land wherever the file ends when they
+    // run, so only plain seekable files can take parallel writes
+    out_off = lseek(out_fd, 0, SEEK_CUR);
+    fl = fcntl(out_fd, F_GETFL);
+    seekable = (out_off != -1 && fl != -1 && !(fl & O_APPEND));
+
+    while (true) {
+        // Free written buffers, in order
+        while (done_seq < wr_seq && slot[done_seq % buf_ct].wr_done) {
+            s = &(slot[done_seq % buf_ct]);
+            s->wr_done = false;
+
+            if (framed)
+                sb_rewind(&(s->sb));
+            else
+                sb_wipe(&(s->sb));
+
+            done_seq++;
+        }
+
+        if (eof && !read_inflight && done_seq == rd_seq) break;
+
+        // Keep a read in flight, into the next free buffer
+        if (!eof && !read_inflight && (rd_seq - done_seq) < (uint64_t)buf_ct) {
+            idx = (int)(rd_seq % buf_ct);
+            su_prep_read_fixed(&su, in_fd, &(slot[idx].sb), idx, (uint64_t)idx);
+            read_inflight = true;
+        }
+
+        // Queue writes of filled buffers, in order
+        while (wr_seq < rd_seq && (seekable || write_inflight == 0)) {
+            idx = (int)(wr_seq % buf_ct);
+            s = &(slot[idx]);
+
+            if (framed) {
+                sb_frame_payload(&(s->sb), &payload_ptr, &payload_len);
+            } else {
+                payload_ptr = s->sb.addr;
+                payload_len = sb_content_len(&(s->sb));
+            }
+
+            s->wr_ptr = payload_ptr;
+            s->wr_len = payload_len;
+            s->wr_off = seekable ? (uint64_t)out_off : SHARKYURING_OFF_CUR;
+
+            if (seekable) out_off += (off_t)payload_len;
+
+            if (payload_len > 0) {
+                su_copy_prep_write_(&su, s, idx, out_fd);
+                write_inflight++;
+            } else {
+                s->wr_done = true;
+            }
+
+            wr_seq++;
+        }
+
+        if (su.inflight == 0) continue;
+
+        // Submit the lot, wait for something to finish, and deal with
+        // everything that has
+        su_submit(&su, 1);
+
+        while (su_reap(&su, &user_data, &res)) {
+            idx = (int)(user_data & ~SU_COPY_WRITE);
+            s = &(slot[idx]);
+
+            if (res < 0 && -res != EINTR && -res != EAGAIN) {
+                errno = -res;
+                perror((user_data & SU_COPY_WRITE) ? "[su_copy_bufs] write" : "[su_copy_bufs] read");
+                exit(4);
+            }
+
+            if (!(user_data & SU_COPY_WRITE)) {
+                read_inflight = false;
+
+                if (res == 0) {
+                    // EOF - pass on whatever made it into the last buffer
+                    eof = true;
+                    if (s->sb.dirty) rd_seq++;
+                } else if (res > 0) {
+                    SB_STAT(&(s->sb), bytes_in, (unsigned long long)res);
+                    s->sb.dirty = true;
+                    s->sb.writer_ptr += res;
+                    s->sb.writer_len_remaining -= (size_t)res;
+
+                    if (s->sb.writer_len_remaining == 0) rd_seq++;
+                }
+            } else {
+                write_inflight--;
+
+                if (res > 0) {
+                    SB_STAT(&(s->sb), bytes_out, (unsigned long long)res);
+                    s->wr_ptr += res;
+                    s->wr_len -= (size_t)res;
+                    if (s->wr_off != SHARKYURING_OFF_CUR) s->wr_off += (uint64_t)res;
+                }
+
+                // Short writes are carried on from where they stopped
+                if (s->wr_len > 0) {
+                    su_copy_prep_write_(&su, s, idx, out_fd);
+                    write_inflight++;
+                } else {
+                    s->wr_done = true;
+                }
+            }
+        }
+    }
+
+    // Leave the file position after what we wrote, as write(2) would have
+    if (seekable && lseek(out_fd, out_off, SEEK_SET) == -1) {
+        perror("[su_copy_bufs] lseek");
+        exit(4);
+    }
+
+    // Clean up
+    for (int i = 0; i < buf_ct; i++)
+        sb_dispose(&(slot[i].sb));
+
+    su_dispose(&su);
+
+    return 0;
+}
@@ -0,0 +1,65 @@
+
+/* vim: set ts=8 sts=4 sw=4 et filetype=c: */
+
+#ifndef SHARKYURING_H
+#define SHARKYURING_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ ***************************************************************
+ * sharkyuring.h    io_uring I/O engine for sharkybufs, using  *
+ *                  raw syscalls                               *
+ *                                                             *
+ ***************************************************************
+ */
+
+
+#define SHARKYURING_MAX_BUFS    16
+#define SHARKYURING_OFF_CUR     ((uint64_t)-1)      /* use and advance the file position */
+
+struct io_uring_sqe;
+struct io_uring_cqe;
+struct sharkybuf;
+
+struct sharkyuring {
+    int                     ring_fd;
+    unsigned                entries;
+    bool                    bufs_registered;
+
+    /* submission queue ring, shared with the kernel */
+    void                   *sq_ring;
+    size_t                  sq_ring_len;
+    unsigned               *sq_head;
+    unsigned               *sq_tail;
+    unsigned               *sq_mask;
+    unsigned               *sq_array;
+    struct io_uring_sqe    *sqes;
+    size_t                  sqes_len;
+
+    /* completion queue ring, shared with the kernel - may be the same
+     * mapping as the submission queue ring
+     */
+    void                   *cq_ring;
+    size_t                  cq_ring_len;
+    unsigned               *cq_head;
+    unsigned               *cq_tail;
+    unsigned               *cq_mask;
+    struct io_uring_cqe    *cqes;
+
+    /* requests submitted and not yet reaped */
+    unsigned                inflight;
+};
+
+int su_create(struct sharkyuring *su, unsigned entries);
+void su_dispose(struct sharkyuring *su);
+int su_register_bufs(struct sharkyuring *su, struct sharkybuf *sbs, int sb_ct);
+void su_prep_read_fixed(struct sharkyuring *su, int fd, struct sharkybuf *sb, int buf_idx, uint64_t user_data);
+void su_prep_write_fixed(struct sharkyuring *su, int fd, const char *ptr, size_t len, int buf_idx,
+                         uint64_t off, uint64_t user_data);
+void su_submit(struct sharkyuring *su, unsigned wait_ct);
+bool su_reap(struct sharkyuring *su, uint64_t *user_data, int *res);
+int su_copy_bufs(int in_fd, int out_fd, size_t buf_len, int buf_ct, bool framed);
+
+#endif /* SHARKYURING_H */